@@ -1,6 +1,7 @@
 
 /* Algo.C */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -19,25 +20,51 @@
 #include "mtf.h"
 #include "ppm.h"
 #include "rle.h"
+#include "thread.h"
 
-/* Variables */
+/* Constants */
+
+#define SLOT_NB 3 /* Blocks in flight: being read, crunched and written */
 
-const char *Source;
-const char *Destination;
+/* Types */
 
-int    Algorithm, Delta, Group, Order, Verbosity;
+typedef struct {
+   uchar  *S;
+   int     Size;     /* Allocated */
+   int     N;        /* Used, 0 => end of file */
+   stream  Out[1];   /* Crunched block, as a bit stream starting at bit Phase */
+   int     Phase;
+   long    BitNb;
+} slot;
 
-uchar *S;
-int    N;
+typedef struct {
+   codec     *Codec;
+   stream    *In;
+   stream    *Out;
+   slot       Slot[SLOT_NB];
+   semaphore  Free[1];   /* Slots the reader may fill */
+   semaphore  Full[1];   /* Slots loaded (crunch) or decrunched (decrunch) */
+   semaphore  Done[1];   /* Slots crunched, ready to be written */
+} pipeline;
+
+/* Variables */
 
 static const char *AlgoName[ALGO_NB+1] = {
-   "STORE", "LZH", "BWT", "PPM", NULL
+   "STORE", "LZH", "BWT", "PPM", "LZX", "FAST", NULL
 };
 
 /* Prototypes */
 
-static void LoadBlock (void);
-static void SaveBlock (void);
+static void InitPipeline (pipeline *Pipeline, codec *Codec, stream *In, stream *Out, int Size);
+static void FreePipeline (pipeline *Pipeline);
+
+static void ReadSlot     (pipeline *Pipeline, slot *Slot);
+static void CrunchSlot   (pipeline *Pipeline, slot *Slot, int Phase);
+static void WriteSlot    (pipeline *Pipeline, slot *Slot);
+
+static void ReadStage    (void *Data);
+static void WriteStage   (void *Data);
+static void SaveStage    (void *Data);
 
 /* Functions */
 
@@ -65,188 +92,495 @@ const char *AlgorithmName(int No) {
    return AlgoName[No];
 }
 
-/* CrunchFile() */
+/* InitCodec() */
 
-void CrunchFile(void) {
+void InitCodec(codec *Codec) {
 
-   uint Crc32;
+   Codec->Version   = ALGO_VERSION;
+   Codec->Algorithm = ALGO_LZH;
+   Codec->Delta     = 0;     /* Delta coding distance */
+   Codec->Group     = FALSE; /* Huffman tree grouping */
+   Codec->Order     = 3;     /* PPM Order */
+   Codec->Level     = LEVEL_DEFAULT;
+   Codec->Window    = WINDOW_DEFAULT;
+   Codec->Long      = FALSE;
+   Codec->Threads   = 1;
+   Codec->Block     = 0;
+   Codec->Verbosity = 0;
+
+   Codec->Dict     = NULL;
+   Codec->DictSize = 0;
+
+   Codec->S = NULL;
+   Codec->N = 0;
+
+   Codec->In  = NULL;
+   Codec->Out = NULL;
+   Codec->Crc = CRC_INIT;
+}
+
+/* CrunchFile() */
+
+void CrunchFile(codec *Codec, const char *Source, const char *Destination) {
 
-   OpenInStream(Source);
+   int I, N, Phase;
+   stream In[1], Out[1];
+   pipeline Pipeline[1];
+   thread Reader[1], Writer[1];
+   slot *Slot;
 
-   N = SIZE;
-   AllocBlock();
+   if (Source == NULL || ! OpenMapStream(In,Source)) OpenInStream(In,Source);
+   OpenOutStream(Out,Destination);
 
-   OpenOutStream(Destination);
+   SendUInt8(Out,'M');
+   SendUInt8(Out,'C');
+   SendUInt8(Out,'r');
+   if (Codec->Version != 0) {
+      SendUInt8(Out,'v');
+      SendUInt8(Out,Codec->Version);
+   }
+   SendUInt8(Out,'0'+Codec->Algorithm);
 
-   SendUInt8('M');
-   SendUInt8('C');
-   SendUInt8('r');
-   SendUInt8('0'+Algorithm);
+   OpenBitStream(Out);
 
-   OpenBitStream(OutStream);
+   InitPipeline(Pipeline,Codec,In,Out,(Codec->Block != 0) ? Codec->Block : SIZE);
 
-   while (! EndOfFile()) {
+   Phase = 0; /* Output bit position modulo 8, the header is byte aligned */
 
-      LoadBlock();
-      if (N == 0) break; /* Late end of file */
-      if (Verbosity >= 2) fprintf(stderr,"N = %d\n",N);
+   if (ThreadSupport()) {
 
-      SendBit(1);
-      SendBits(25,N);
+      /* Reading the next block and writing the previous one overlap with crunching */
 
-      Crc32 = CRC(S,N);
-      if (Verbosity >= 2) fprintf(stderr,"CRC = 0x%08X\n",Crc32);
+      StartThread(Reader,&ReadStage,Pipeline);
+      StartThread(Writer,&WriteStage,Pipeline);
 
-      if (Algorithm != ALGO_STORE) {
-	 if (Delta == -1) Delta = BestDelta(S,N);
-	 if (Verbosity >= 2) fprintf(stderr,"Delta = %d\n",Delta);
-	 if (Delta != 0) CodeDelta(S,N);
+      for (I = 0; TRUE; I = (I + 1) % SLOT_NB) {
+         Slot = &Pipeline->Slot[I];
+         WaitSemaphore(Pipeline->Full);
+         N = Slot->N;
+         if (N != 0) {
+            CrunchSlot(Pipeline,Slot,Phase);
+            Phase = Slot->BitNb & 7;
+         }
+         PostSemaphore(Pipeline->Done); /* The slot belongs to the writer from now on */
+         if (N == 0) break;
       }
 
-      CrunchBlock();
+      JoinThread(Reader);
+      JoinThread(Writer);
+
+   } else {
 
-      if (Algorithm != ALGO_STORE) SendBits(DELTA_BIT,Delta);
+      Slot = &Pipeline->Slot[0];
 
-      SendBits(16,(Crc32>>16)&0xFFFF);
-      SendBits(16,Crc32&0xFFFF);
+      while (TRUE) {
+         ReadSlot(Pipeline,Slot);
+         if (Slot->N == 0) break;
+         CrunchSlot(Pipeline,Slot,Phase);
+         Phase = Slot->BitNb & 7;
+         WriteSlot(Pipeline,Slot);
+      }
    }
 
-   SendBit(0);
+   FreePipeline(Pipeline);
 
-   CloseBitStream(OutStream);
+   SendBit(Out,0);
 
-   FreeBlock();
+   CloseBitStream(Out);
 
-   CloseOutStream();
-   CloseInStream();
+   CloseStream(Out);
+   CloseStream(In);
 }
 
 /* DecrunchFile() */
 
-void DecrunchFile(void) {
+void DecrunchFile(codec *Codec, const char *Source, const char *Destination) {
 
+   int C, I, N;
    uint Crc32;
+   stream In[1], Out[1];
+   pipeline Pipeline[1];
+   thread Writer[1];
+   slot *Slot;
 
-   OpenInStream(Source);
+   if (Source == NULL || ! OpenMapStream(In,Source)) OpenInStream(In,Source);
 
-   if (GetUInt8() != 'M' || GetUInt8() != 'C' || GetUInt8() != 'r') {
+   if (GetUInt8(In) != 'M' || GetUInt8(In) != 'C' || GetUInt8(In) != 'r') {
       FatalError("Not an MCr file");
    }
 
-   Algorithm = GetUInt8() - '0';
-   if (Algorithm < 0 || Algorithm >= ALGO_NB) {
-      FatalError("Unknown algorithm %d",Algorithm);
+   C = GetUInt8(In);
+
+   if (C == 'v') { /* Versioned framing */
+      Codec->Version = GetUInt8(In);
+      if (Codec->Version < 1 || Codec->Version > ALGO_VERSION) {
+         FatalError("Unknown MCr version %d",Codec->Version);
+      }
+      C = GetUInt8(In);
+   } else {
+      Codec->Version = 0;
+   }
+
+   Codec->Algorithm = C - '0';
+   if (Codec->Algorithm < 0 || Codec->Algorithm >= ALGO_NB) {
+      FatalError("Unknown algorithm %d",Codec->Algorithm);
    }
 
-   OpenOutStream(Destination);
+   OpenOutStream(Out,Destination);
+
+   OpenBitStream(In);
 
-   OpenBitStream(InStream);
+   /* Block boundaries are only known once decoded => no reader stage, a writer overlaps */
 
-   while (GetBit() == 1) {
+   InitPipeline(Pipeline,Codec,In,Out,0);
 
-      N = GetBits(25);
-      if (Verbosity >= 2) fprintf(stderr,"N = %d\n",N);
+   if (ThreadSupport()) StartThread(Writer,&SaveStage,Pipeline);
 
-      AllocBlock();
+   Codec->In = In;
 
-      DecrunchBlock();
+   for (I = 0; TRUE; I = (I + 1) % SLOT_NB) {
 
-      if (Algorithm != ALGO_STORE) {
-	 Delta = GetBits(DELTA_BIT);
-	 if (Verbosity >= 2) fprintf(stderr,"Delta = %d\n",Delta);
-	 if (Delta != 0) DecodeDelta(S,N);
+      Slot = &Pipeline->Slot[I];
+      if (ThreadSupport()) WaitSemaphore(Pipeline->Free);
+
+      if (GetBit(In) != 1) {
+         Slot->N = 0;
+         if (ThreadSupport()) PostSemaphore(Pipeline->Full);
+         break;
+      }
+
+      N = GetLength(Codec);
+      if (Codec->Verbosity >= 2) fprintf(stderr,"N = %d\n",N);
+
+      if (N > Slot->Size) { /* Buffers are kept from one block to the next */
+         if (Slot->S != NULL) Free(Slot->S);
+         Slot->S    = Nalloc(N,"Cruncher block");
+         Slot->Size = N;
       }
 
-      Crc32 =  GetBits(16) << 16;
-      Crc32 |= GetBits(16);
-      if (Verbosity >= 2) fprintf(stderr,"CRC = 0x%08X\n",Crc32);
+      Codec->S = Slot->S;
+      Codec->N = N;
+
+      DecrunchBlock(Codec);
+
+      if (Codec->Algorithm != ALGO_STORE) {
+	 Codec->Delta = GetBits(In,DELTA_BIT);
+	 if (Codec->Verbosity >= 2) fprintf(stderr,"Delta = %d\n",Codec->Delta);
+	 if (Codec->Delta != 0) DecodeDelta(Codec->S,Codec->N,Codec->Delta);
+      }
 
-      if (CRC(S,N) != Crc32) Error("Bad CRC (0x%08X exp 0x%08X found)",Crc32,CRC(S,N));
+      Crc32 =  GetBits(In,16) << 16;
+      Crc32 |= GetBits(In,16);
+      if (Codec->Verbosity >= 2) fprintf(stderr,"CRC = 0x%08X\n",Crc32);
 
-      SaveBlock();
-      FreeBlock();
+      if (CRC(Codec->S,Codec->N) != Crc32) Error("Bad CRC (0x%08X exp 0x%08X found)",Crc32,CRC(Codec->S,Codec->N));
+
+      Slot->N = N;
+
+      if (ThreadSupport()) {
+         PostSemaphore(Pipeline->Full);
+      } else {
+         SendBlock(Out,Slot->S,Slot->N);
+      }
    }
 
-   CloseBitStream(InStream);
+   if (ThreadSupport()) JoinThread(Writer);
+
+   CloseBitStream(In);
 
-   CloseInStream();
-   CloseOutStream();
+   Codec->In = NULL;
+   Codec->S  = NULL;
+   Codec->N  = 0;
+
+   FreePipeline(Pipeline);
+
+   CloseStream(In);
+   CloseStream(Out);
 }
 
 /* CrunchBlock() */
 
-void CrunchBlock(void) {
+void CrunchBlock(codec *Codec) {
 
-   switch (Algorithm) { 
+   switch (Codec->Algorithm) { 
    case ALGO_STORE :
-      CloseBitStream(OutStream);
-      SendBlock(S,N);
-      OpenBitStream(OutStream);
+      CloseBitStream(Codec->Out);
+      SendBlock(Codec->Out,Codec->S,Codec->N);
+      OpenBitStream(Codec->Out);
       break;
    case ALGO_LZH :
-      CodeLZ77();
+   case ALGO_LZX :
+      CodeLZ77(Codec);
+      break;
+   case ALGO_FAST :
+      CodeFast(Codec);
       break;
    case ALGO_BWT :
-      CodeBWT();
+      CodeBWT(Codec);
       break;
    case ALGO_PPM :
-      CodePPM();
+      CodePPM(Codec);
       break;
    }
 }
 
 /* DecrunchBlock() */
 
-void DecrunchBlock(void) {
+void DecrunchBlock(codec *Codec) {
 
-   switch (Algorithm) {
+   switch (Codec->Algorithm) {
    case ALGO_STORE :
-      CloseBitStream(InStream);
-      GetBlock(S,N);
-      OpenBitStream(InStream);
+      CloseBitStream(Codec->In);
+      GetBlock(Codec->In,Codec->S,Codec->N);
+      OpenBitStream(Codec->In);
       break;
    case ALGO_LZH :
-      DecodeLZ77();
+   case ALGO_LZX :
+      DecodeLZ77(Codec);
+      break;
+   case ALGO_FAST :
+      DecodeFast(Codec);
       break;
    case ALGO_BWT :
-      DecodeBWT();
+      DecodeBWT(Codec);
       break;
    case ALGO_PPM :
-      DecodePPM();
+      DecodePPM(Codec);
       break;
    }
 }
 
 /* AllocBlock() */
 
-void AllocBlock(void) {
+void AllocBlock(codec *Codec) {
 
-   S = Nalloc(N,"Cruncher block");
+   Codec->S = Nalloc(Codec->N,"Cruncher block");
 }
 
 /* FreeBlock() */
 
-void FreeBlock(void) {
+void FreeBlock(codec *Codec) {
 
-   if (S != NULL) {
-      Free(S);
-      S = NULL;
+   if (Codec->S != NULL) {
+      Free(Codec->S);
+      Codec->S = NULL;
    }
 }
 
-/* LoadBlock() */
+/* GetLength() */
 
-static void LoadBlock(void) {
+int GetLength(codec *Codec) {
 
-   N = GetBlock(S,SIZE);
+   uint64 Length;
+
+   if (Codec->Version == 0) return (int) GetBits(Codec->In,25);
+
+   Length = GetSize(Codec->In);
+   if (Length > INT_MAX) FatalError("Length (%.0f) too large for this host",(double)Length);
+
+   return (int) Length;
 }
 
-/* SaveBlock() */
+/* SendLength() */
+
+void SendLength(codec *Codec, int Length) {
 
-static void SaveBlock(void) {
+   assert(Length>=0);
 
-   SendBlock(S,N);
+   if (Codec->Version == 0) {
+      if (Length >= 1 << 25) FatalError("Length (%d) too large for version 0 framing",Length);
+      SendBits(Codec->Out,25,Length);
+   } else {
+      SendSize(Codec->Out,Length);
+   }
 }
 
-/* End of Algo.C */
+/* InitPipeline() */
+
+static void InitPipeline(pipeline *Pipeline, codec *Codec, stream *In, stream *Out, int Size) {
+
+   int I;
+
+   Pipeline->Codec = Codec;
+   Pipeline->In    = In;
+   Pipeline->Out   = Out;
+
+   for (I = 0; I < SLOT_NB; I++) {
+      Pipeline->Slot[I].S     = NULL; /* See ReadSlot() */
+      Pipeline->Slot[I].Size  = Size;
+      Pipeline->Slot[I].N     = 0;
+      Pipeline->Slot[I].Phase = 0;
+      Pipeline->Slot[I].BitNb = 0;
+   }
+
+   InitSemaphore(Pipeline->Free,SLOT_NB);
+   InitSemaphore(Pipeline->Full,0);
+   InitSemaphore(Pipeline->Done,0);
+}
+
+/* FreePipeline() */
+
+static void FreePipeline(pipeline *Pipeline) {
+
+   int I;
+
+   for (I = 0; I < SLOT_NB; I++) {
+      if (Pipeline->Slot[I].S != NULL) {
+         Free(Pipeline->Slot[I].S);
+         Pipeline->Slot[I].S = NULL;
+      }
+   }
+
+   FreeSemaphore(Pipeline->Free);
+   FreeSemaphore(Pipeline->Full);
+   FreeSemaphore(Pipeline->Done);
+}
 
+/* ReadSlot() */
+
+static void ReadSlot(pipeline *Pipeline, slot *Slot) {
+
+   if (EndOfFile(Pipeline->In)) {
+      Slot->N = 0;
+   } else {
+      if (Slot->S == NULL) Slot->S = Nalloc(Slot->Size,"Cruncher block"); /* Small files use only one slot */
+      Slot->N = GetBlock(Pipeline->In,Slot->S,Slot->Size); /* 0 => late end of file */
+   }
+}
+
+/* CrunchSlot() */
+
+static void CrunchSlot(pipeline *Pipeline, slot *Slot, int Phase) {
+
+   uint Crc32;
+   codec *Codec;
+
+   Codec = Pipeline->Codec;
+
+   Codec->S   = Slot->S;
+   Codec->N   = Slot->N;
+   Codec->Out = Slot->Out;
+
+   if (Codec->Verbosity >= 2) fprintf(stderr,"N = %d\n",Codec->N);
+
+   /* The block is crunched at the bit alignment it will have in the file, so that byte padding (store) is unchanged */
+
+   OpenMemStream(Slot->Out,STREAM_WRITE,NULL,Slot->N/2);
+   OpenBitStream(Slot->Out);
+
+   Slot->Phase = Phase;
+   if (Phase != 0) SendBits(Slot->Out,Phase,0);
+
+   SendBit(Slot->Out,1);
+   SendLength(Codec,Codec->N);
+
+   Crc32 = CRC(Codec->S,Codec->N);
+   if (Codec->Verbosity >= 2) fprintf(stderr,"CRC = 0x%08X\n",Crc32);
+
+   if (Codec->Algorithm != ALGO_STORE) {
+      if (Codec->Delta == -1) Codec->Delta = BestDelta(Codec->S,Codec->N);
+      if (Codec->Verbosity >= 2) fprintf(stderr,"Delta = %d\n",Codec->Delta);
+      if (Codec->Delta != 0) CodeDelta(Codec->S,Codec->N,Codec->Delta);
+   }
+
+   CrunchBlock(Codec);
+
+   if (Codec->Algorithm != ALGO_STORE) SendBits(Slot->Out,DELTA_BIT,Codec->Delta);
+
+   SendBits(Slot->Out,16,(Crc32>>16)&0xFFFF);
+   SendBits(Slot->Out,16,Crc32&0xFFFF);
+
+   Slot->BitNb = TellBits(Slot->Out);
+
+   CloseBitStream(Slot->Out);
+
+   Codec->S   = NULL;
+   Codec->N   = 0;
+   Codec->Out = NULL;
+}
+
+/* WriteSlot() */
+
+static void WriteSlot(pipeline *Pipeline, slot *Slot) {
+
+   int Size;
+   long BitNb;
+   void *Data;
+   stream Block[1];
+
+   Data = MemStreamData(Slot->Out,&Size);
+
+   OpenMemStream(Block,STREAM_READ,Data,Size);
+   OpenBitStream(Block);
+
+   if (Slot->Phase != 0) GetBits(Block,Slot->Phase); /* Already accounted for in the output */
+
+   for (BitNb = Slot->BitNb - Slot->Phase; BitNb >= 32; BitNb -= 32) {
+      SendBits(Pipeline->Out,32,GetBits(Block,32));
+   }
+   if (BitNb != 0) SendBits(Pipeline->Out,(int)BitNb,GetBits(Block,(int)BitNb));
+
+   CloseBitStream(Block);
+   CloseStream(Block);
+
+   CloseStream(Slot->Out);
+}
+
+/* ReadStage() */
+
+static void ReadStage(void *Data) {
+
+   int I;
+   pipeline *Pipeline;
+   slot *Slot;
+
+   Pipeline = Data;
+
+   for (I = 0; TRUE; I = (I + 1) % SLOT_NB) {
+      Slot = &Pipeline->Slot[I];
+      WaitSemaphore(Pipeline->Free);
+      ReadSlot(Pipeline,Slot);
+      PostSemaphore(Pipeline->Full);
+      if (Slot->N == 0) break;
+   }
+}
+
+/* WriteStage() */
+
+static void WriteStage(void *Data) {
+
+   int I;
+   pipeline *Pipeline;
+   slot *Slot;
+
+   Pipeline = Data;
+
+   for (I = 0; TRUE; I = (I + 1) % SLOT_NB) {
+      Slot = &Pipeline->Slot[I];
+      WaitSemaphore(Pipeline->Done);
+      if (Slot->N == 0) break;
+      WriteSlot(Pipeline,Slot);
+      PostSemaphore(Pipeline->Free);
+   }
+}
+
+/* SaveStage() */
+
+static void SaveStage(void *Data) {
+
+   int I;
+   pipeline *Pipeline;
+   slot *Slot;
+
+   Pipeline = Data;
+
+   for (I = 0; TRUE; I = (I + 1) % SLOT_NB) {
+      Slot = &Pipeline->Slot[I];
+      WaitSemaphore(Pipeline->Full);
+      if (Slot->N == 0) break;
+      SendBlock(Pipeline->Out,Slot->S,Slot->N);
+      PostSemaphore(Pipeline->Free);
+   }
+}
+
+/* End of Algo.C */
@@ -5,34 +5,68 @@
 #define ALGO_H
 
 #include "types.h"
+#include "bitio.h"
 
 /* Constants */
 
-enum { ALGO_STORE, ALGO_LZH, ALGO_BWT, ALGO_PPM, ALGO_NB };
-
-/* Variables */
-
-extern const char *Source;
-extern const char *Destination;
-
-extern int    Algorithm, Delta, Group, Order, Verbosity;
-
-extern uchar *S;
-extern int    N;
+enum { ALGO_STORE, ALGO_LZH, ALGO_BWT, ALGO_PPM, ALGO_LZX, ALGO_FAST, ALGO_NB };
+
+#define ALGO_VERSION 4 /* Block framing: 0 = 25-bit sizes, 1 = variable-length sizes, 2 = LZ77 dictionary id, 3 = BWT chain starts, 4 = BWT chunks */
+
+#define LEVEL_MIN     1 /* Fastest LZ77 match search */
+#define LEVEL_MAX     9 /* Best LZ77 match search */
+#define LEVEL_DEFAULT 6
+
+#define WINDOW_MIN     16 /* LZX window size, log2 */
+#define WINDOW_MAX     27 /* 2 ints per window byte (tree) must fit an int size */
+#define WINDOW_DEFAULT 24
+
+#define THREAD_MAX 64 /* LZ77 match finding threads */
+
+#define BLOCK_MIN 100     /* Block size, KB */
+#define BLOCK_MAX 262144  /* Int sizes: 4 bytes per byte (LZ77 distances, BWT), 2x output growth */
+
+/* Types */
+
+typedef struct {
+   int     Version;   /* Block framing */
+   int     Algorithm;
+   int     Delta;
+   int     Group;
+   int     Order;
+   int     Level;     /* LZ77 match search effort */
+   int     Window;    /* LZX window size, log2 */
+   int     Long;      /* LZX long match pre-pass over the whole block */
+   int     Threads;   /* LZ77 match finding threads */
+   int     Block;     /* Block size, 0 = default (SIZE, CHUNK_SIZE for BWT members) */
+   int     Verbosity;
+   uchar  *Dict;      /* LZ77 preset dictionary, NULL if none */
+   int     DictSize;
+   uchar  *S;         /* Block, NULL => LZ77 decodes to Out instead, see Crc */
+   int     N;         /* Block size */
+   stream *In;
+   stream *Out;
+   uint    Crc;       /* Of the bytes decoded to Out, delta undone */
+} codec;
 
 /* Prototypes */
 
 extern int         AlgorithmNo   (const char *Name);
 extern const char *AlgorithmName (int No);
 
-extern void CrunchFile    (void);
-extern void DecrunchFile  (void);
+extern void InitCodec     (codec *Codec);
+
+extern void CrunchFile    (codec *Codec, const char *Source, const char *Destination);
+extern void DecrunchFile  (codec *Codec, const char *Source, const char *Destination);
+
+extern void CrunchBlock   (codec *Codec);
+extern void DecrunchBlock (codec *Codec);
 
-extern void CrunchBlock   (void);
-extern void DecrunchBlock (void);
+extern void AllocBlock    (codec *Codec);
+extern void FreeBlock     (codec *Codec);
 
-extern void AllocBlock    (void);
-extern void FreeBlock     (void);
+extern int  GetLength     (codec *Codec);
+extern void SendLength    (codec *Codec, int Length);
 
 #endif /* ! defined ALGO_H */
 
@@ -16,6 +16,7 @@
 /* Prototypes */
 
 static void GetFileInfo (archive *Archive);
+static void GetDict     (archive *Archive);
 static void DispHeader  (const header *Header);
 
 /* Functions */
@@ -26,18 +27,30 @@ archive *OpenArchive(const char *Name) {
 
    archive *Archive;
 
-   OpenInStream(Name);
+   Archive = Nalloc(sizeof(archive),"Archive structure");
 
-   if (GetUInt8() != 'M' || GetUInt8() != 'A' || GetUInt8() != 'r') {
-      CloseInStream();
+   if (! OpenMapStream(Archive->Stream,Name)) {
+      Free(Archive);
       return NULL;
    }
-   GetUInt8();
 
-   Archive = Nalloc(sizeof(archive),"Archive structure");
+   if (GetUInt8(Archive->Stream) != 'M' || GetUInt8(Archive->Stream) != 'A' || GetUInt8(Archive->Stream) != 'r') {
+      CloseStream(Archive->Stream);
+      Free(Archive);
+      return NULL;
+   }
+
+   Archive->Version = GetUInt8(Archive->Stream) - '0';
+   if (Archive->Version < 0 || Archive->Version > ALGO_VERSION) {
+      CloseStream(Archive->Stream);
+      Free(Archive);
+      return NULL;
+   }
+
+   strcpy(Archive->Name,(Name != NULL) ? Name : "-");
 
-   strcpy(Archive->Name,Name);
-   Archive->Stream = InStream;
+   Archive->Dict     = NULL;
+   Archive->DictSize = 0;
 
    GetFileInfo(Archive);
 
@@ -48,10 +61,9 @@ archive *OpenArchive(const char *Name) {
 
 void CloseArchive(archive *Archive) {
 
-/*
-   InStream = Archive->Stream;
-*/
-   CloseInStream();
+   CloseStream(Archive->Stream);
+
+   if (Archive->Dict != NULL) Free(Archive->Dict);
 
    Free(Archive);
 }
@@ -60,11 +72,7 @@ void CloseArchive(archive *Archive) {
 
 int FirstFile(archive *Archive) {
 
-/*
-   InStream = Archive->Stream;
-*/
-
-   if (fseek(Archive->Stream->File,4,SEEK_SET) != 0) Error("FirstFile(): fseek()");
+   if (SeekStream(Archive->Stream,4) != 0) Error("FirstFile(): SeekStream()");
    GetFileInfo(Archive);
 
    return ! Archive->End;
@@ -74,19 +82,15 @@ int FirstFile(archive *Archive) {
 
 int NextFile(archive *Archive) {
 
-/*
-   InStream = Archive->Stream;
-*/
-
    if (Archive->End) return FALSE;
 
-   if (fseek(Archive->Stream->File,Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize,SEEK_SET) != 0) {
-      Error("NextFile(): fseek()");
+   if (SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize) != 0) {
+      Error("NextFile(): SeekStream()");
       Archive->End = TRUE;
       return FALSE;
    }
-   if (ftell(Archive->Stream->File) != Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize) {
-      Error("NextFile(): ftell()");
+   if (TellStream(Archive->Stream) != Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize) {
+      Error("NextFile(): TellStream()");
       Archive->End = TRUE;
       return FALSE;
    }
@@ -100,118 +104,220 @@ int NextFile(archive *Archive) {
 
 void ReadFile(archive *Archive, void *Address) {
 
-   fseek(Archive->Stream->File,Archive->Pos+Archive->Header->HeaderSize,SEEK_SET);
+   codec Codec[1];
+
+   SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize);
 
    if (Archive->Header->Algorithm == ALGO_STORE) {
 
-      GetBlock(Address,Archive->Header->FileSize);
+      GetBlock(Archive->Stream,Address,Archive->Header->FileSize);
 
    } else {
 
-      InitCruncher();
-      Algorithm = Archive->Header->Algorithm;
+      InitCodec(Codec);
+      Codec->Version   = Archive->Version;
+      Codec->Algorithm = Archive->Header->Algorithm;
+      Codec->Dict      = Archive->Dict;
+      Codec->DictSize  = Archive->DictSize;
+      Codec->In        = Archive->Stream;
 
       OpenBitStream(Archive->Stream);
 
-      S = Address;
-      N = Archive->Header->FileSize;
-      DecrunchBlock();
+      Codec->S = Address;
+      Codec->N = Archive->Header->FileSize;
+      DecrunchBlock(Codec);
 
       CloseBitStream(Archive->Stream);
 
       if (Archive->Header->Delta != 0) {
-	 Delta = Archive->Header->Delta;
-	 DecodeDelta(Address,Archive->Header->FileSize);
+	 Codec->Delta = Archive->Header->Delta;
+	 DecodeDelta(Address,Archive->Header->FileSize,Codec->Delta);
       }
    }
 
    if (CRC(Address,Archive->Header->FileSize) != Archive->Header->FileCRC) FatalError("Bad CRC");
 }
 
-/* InitCruncher() */
+/* WriteFile() */
+
+void WriteFile(archive *Archive, stream *Stream) {
+
+   int Size, Left;
+   uint Crc;
+   void *Block;
+   codec Codec[1];
+
+   /* Decompresses to Stream (NULL = check only). LZ77 and stored files */
+   /* go through a small window instead of being held in memory        */
+
+   SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize);
+
+   switch (Archive->Header->Algorithm) {
+
+   case ALGO_STORE :
+
+      Block = Nalloc(STREAM_BUFFER_SIZE,"File buffer");
+      Crc   = CRC_INIT;
+
+      for (Left = Archive->Header->FileSize; Left > 0; Left -= Size) {
+         Size = (Left < STREAM_BUFFER_SIZE) ? Left : STREAM_BUFFER_SIZE;
+         if (GetBlock(Archive->Stream,Block,Size) != Size) FatalError("Truncated archive");
+         Crc = UpdateCRC(Crc,Block,Size);
+         if (Stream != NULL) SendBlock(Stream,Block,Size);
+      }
+
+      Free(Block);
+
+      break;
+
+   case ALGO_LZH :
+   case ALGO_LZX :
+
+      InitCodec(Codec);
+      Codec->Version   = Archive->Version;
+      Codec->Algorithm = Archive->Header->Algorithm;
+      Codec->Delta     = Archive->Header->Delta;
+      Codec->Dict      = Archive->Dict;
+      Codec->DictSize  = Archive->DictSize;
+      Codec->In        = Archive->Stream;
+      Codec->Out       = Stream;
+
+      OpenBitStream(Archive->Stream);
+
+      Codec->S = NULL;
+      Codec->N = Archive->Header->FileSize;
+      DecrunchBlock(Codec);
+
+      CloseBitStream(Archive->Stream);
+
+      Crc = Codec->Crc;
+
+      break;
+
+   default :
+
+      Block = Nalloc(Archive->Header->FileSize,Archive->Header->FileName);
+      ReadFile(Archive,Block);
+      if (Stream != NULL) SendBlock(Stream,Block,Archive->Header->FileSize);
+      Free(Block);
+
+      return; /* Checked */
+   }
+
+   if (Crc != Archive->Header->FileCRC) FatalError("Bad CRC");
+}
+
+/* MapFile() */
 
-void InitCruncher(void) {
+const void *MapFile(archive *Archive) {
 
-   Algorithm = ALGO_LZH;
+   const uchar *Block;
+   int Size, Start;
 
-   Delta     = 0; /* Delta coding distance */
-   Order     = 3; /* PPM Order */
-   Verbosity = 0;
+   if (Archive->Stream->Type != STREAM_MEMORY || Archive->Header->Algorithm != ALGO_STORE) return NULL;
+
+   Block = MemStreamData(Archive->Stream,&Size);
+   Start = Archive->Pos + Archive->Header->HeaderSize;
+   if (Archive->Header->FileSize > Size - Start) FatalError("Truncated archive");
+
+   Block += Start;
+
+   if (CRC(Block,Archive->Header->FileSize) != Archive->Header->FileCRC) FatalError("Bad CRC");
+
+   return Block;
 }
 
 /* GetFileInfo() */
 
 static void GetFileInfo(archive *Archive) {
 
-/*
-   InStream = Archive->Stream;
-*/
+   while (TRUE) {
 
-   Archive->Pos = ftell(Archive->Stream->File);
-   if (Archive->Pos == -1) {
-      Error("GetFileInfo(): ftell()");
-      Archive->End = TRUE;
-      return;
-   }
+      Archive->Pos = TellStream(Archive->Stream);
+      if (Archive->Pos == -1) {
+         Error("GetFileInfo(): TellStream()");
+         Archive->End = TRUE;
+         return;
+      }
 
-   GetHeader(Archive->Stream,Archive->Header);
-   if (Archive->Header->HeaderSize == 0 || EndOfFile()) {
-      Archive->End = TRUE;
-      return;
+      GetHeader(Archive->Stream,Archive->Header);
+      if (Archive->Header->HeaderSize == 0 || EndOfFile(Archive->Stream)) {
+         Archive->End = TRUE;
+         return;
+      }
+
+      /* A nameless stored member holds the dictionary, it isn't listed */
+
+      if (Archive->Version >= 2 && Archive->Header->FileNameSize == 0 && Archive->Header->Algorithm == ALGO_STORE) {
+         if (Archive->Dict == NULL) GetDict(Archive);
+      } else {
+         break;
+      }
+
+      if (SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize) != 0) {
+         Error("GetFileInfo(): SeekStream()");
+         Archive->End = TRUE;
+         return;
+      }
    }
 
-   if (fseek(Archive->Stream->File,Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize,SEEK_SET) != 0) {
-      Error("GetFileInfo(): fseek()");
+   if (SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize+Archive->Header->ArcSize) != 0) {
+      Error("GetFileInfo(): SeekStream()");
       Archive->End = TRUE;
       return;
    }
 
-   Archive->End = EndOfFile();
+   Archive->End = EndOfFile(Archive->Stream);
 
-   if (fseek(Archive->Stream->File,Archive->Pos,SEEK_SET) != 0) {
-      Error("GetFileInfo(): fseek()");
+   if (SeekStream(Archive->Stream,Archive->Pos) != 0) {
+      Error("GetFileInfo(): SeekStream()");
       Archive->End = TRUE;
       return;
    }
 }
 
+/* GetDict() */
+
+static void GetDict(archive *Archive) {
+
+   SeekStream(Archive->Stream,Archive->Pos+Archive->Header->HeaderSize);
+
+   Archive->DictSize = Archive->Header->FileSize;
+   Archive->Dict     = Nalloc(Archive->DictSize+1,"Archive dictionary");
+
+   if (GetBlock(Archive->Stream,Archive->Dict,Archive->DictSize) != Archive->DictSize) FatalError("Truncated archive");
+   if (CRC(Archive->Dict,Archive->DictSize) != Archive->Header->FileCRC) FatalError("Bad dictionary CRC");
+}
+
 /* GetHeader() */
 
 void GetHeader(stream *Stream, header *Header) {
 
-/*
-   InStream = Stream;
-*/
-
-   Header->HeaderSize = GetUInt16();
-   Header->ArcSize = GetUInt32();
-   Header->FileNameSize = GetUInt16();
-   GetBlock(Header->FileName,Header->FileNameSize);
+   Header->HeaderSize = GetUInt16(Stream);
+   Header->ArcSize = GetUInt32(Stream);
+   Header->FileNameSize = GetUInt16(Stream);
+   GetBlock(Stream,Header->FileName,Header->FileNameSize);
    Header->FileName[Header->FileNameSize] = '\0';
-   Header->FileSize = GetUInt32();
-   Header->Algorithm = GetUInt8();
-   Header->Delta = GetUInt8();
-   Header->FileCRC = GetUInt32();
-   Header->HeaderCRC = GetUInt32();
+   Header->FileSize = GetUInt32(Stream);
+   Header->Algorithm = GetUInt8(Stream);
+   Header->Delta = GetUInt8(Stream);
+   Header->FileCRC = GetUInt32(Stream);
+   Header->HeaderCRC = GetUInt32(Stream);
 }
 
 /* SendHeader() */
 
 void SendHeader(stream *Stream, const header *Header) {
 
-/*
-   OutStream = Stream;
-*/
-
-   SendUInt16(Header->HeaderSize);
-   SendUInt32(Header->ArcSize);
-   SendUInt16(Header->FileNameSize);
-   SendBlock(Header->FileName,Header->FileNameSize);
-   SendUInt32(Header->FileSize);
-   SendUInt8(Header->Algorithm);
-   SendUInt8(Header->Delta);
-   SendUInt32(Header->FileCRC);
-   SendUInt32(Header->HeaderCRC);
+   SendUInt16(Stream,Header->HeaderSize);
+   SendUInt32(Stream,Header->ArcSize);
+   SendUInt16(Stream,Header->FileNameSize);
+   SendBlock(Stream,Header->FileName,Header->FileNameSize);
+   SendUInt32(Stream,Header->FileSize);
+   SendUInt8(Stream,Header->Algorithm);
+   SendUInt8(Stream,Header->Delta);
+   SendUInt32(Stream,Header->FileCRC);
+   SendUInt32(Stream,Header->HeaderCRC);
 }
 
 /* DispHeader() */
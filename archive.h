@@ -23,9 +23,12 @@ typedef struct {
 
 typedef struct {
    char    Name[255+1];
+   int     Version;     /* Also the block framing of the members */
+   uchar  *Dict;        /* LZ77 dictionary of the members, NULL if none */
+   int     DictSize;
    header  Header[1];
    int     End;
-   stream *Stream;      /* Private */
+   stream  Stream[1];   /* Private */
    int     Pos;         /* Private */
 } archive;
 
@@ -37,8 +40,9 @@ extern void     CloseArchive (archive *Archive);
 extern int      FirstFile    (archive *Archive);
 extern int      NextFile     (archive *Archive);
 
-extern void     InitCruncher (void);
 extern void     ReadFile     (archive *Archive, void *Address);
+extern void     WriteFile    (archive *Archive, stream *Stream);
+extern const void *MapFile   (archive *Archive);
 
 extern void     GetHeader    (stream *Stream, header *Header);
 extern void     SendHeader   (stream *Stream, const header *Header);
@@ -14,12 +14,6 @@
 #define CODE_BIT 16
 #define FREQ_BIT 14
 
-/* Variables */
-
-static int One, Half, Quarter, ThreeQuarters;
-static int Low, High;
-static int Bpf, Code;
-
 /* Prototypes */
 
 static void InitFreqs     (aritable *AriTable);
@@ -27,7 +21,7 @@ static void IncFreq       (aritable *AriTable, int Symbol);
 
 static void HalveFreqs    (aritable *AriTable);
 
-static void BitPlusFollow (int Bit);
+static void BitPlusFollow (aricoder *Coder, int Bit);
 
 /* Functions */
 
@@ -120,12 +114,12 @@ static void HalveFreqs(aritable *AriTable) {
 
 /* GetFreqs() */
 
-void GetFreqs(aritable *AriTable) {
+void GetFreqs(stream *Stream, aritable *AriTable) {
 
    int S;
 
    for (S = 0; S < AriTable->N; S++) {
-      AriTable->AriSym[S].Freq = GetBits(FREQ_BIT);
+      AriTable->AriSym[S].Freq = GetBits(Stream,FREQ_BIT);
    }
 
    InitFreqs(AriTable);
@@ -133,179 +127,183 @@ void GetFreqs(aritable *AriTable) {
 
 /* SendFreqs() */
 
-void SendFreqs(const aritable *AriTable) {
+void SendFreqs(stream *Stream, const aritable *AriTable) {
 
    int S;
 
    for (S = 0; S < AriTable->N; S++) {
-      SendBits(FREQ_BIT,AriTable->AriSym[S].Freq);
+      SendBits(Stream,FREQ_BIT,AriTable->AriSym[S].Freq);
    }
 }
 
 /* SendStart() */
 
-void SendStart(void) {
+void SendStart(aricoder *Coder, stream *Stream) {
 
-   One           = 1 << CODE_BIT;
-   Half          = One >> 1;
-   Quarter       = Half >> 1;
-   ThreeQuarters = Half + Quarter;
+   Coder->Stream = Stream;
 
-   Low  = 0;
-   High = One;
+   Coder->One           = 1 << CODE_BIT;
+   Coder->Half          = Coder->One >> 1;
+   Coder->Quarter       = Coder->Half >> 1;
+   Coder->ThreeQuarters = Coder->Half + Coder->Quarter;
 
-   Bpf = 0;
+   Coder->Low  = 0;
+   Coder->High = Coder->One;
+
+   Coder->Bpf = 0;
 }
 
 /* SendEnd() */
 
-void SendEnd(void) {
+void SendEnd(aricoder *Coder) {
 
-   if (Low == 0 && High == One && Bpf == 0) {
+   if (Coder->Low == 0 && Coder->High == Coder->One && Coder->Bpf == 0) {
       ;
-   } else if (Low == 0) {
-      BitPlusFollow(0);
-   } else if (High == One) {
-      BitPlusFollow(1);
+   } else if (Coder->Low == 0) {
+      BitPlusFollow(Coder,0);
+   } else if (Coder->High == Coder->One) {
+      BitPlusFollow(Coder,1);
    } else {
-      Bpf++;
-      if (Low < Quarter) {
-         BitPlusFollow(0);
+      Coder->Bpf++;
+      if (Coder->Low < Coder->Quarter) {
+         BitPlusFollow(Coder,0);
       } else {
-         BitPlusFollow(1);
+         BitPlusFollow(Coder,1);
       }
    }
 
-   SendBits(CODE_BIT,0); /* because of decoder lookup */
+   SendBits(Coder->Stream,CODE_BIT,0); /* because of decoder lookup */
 }
 
 /* SendAriSym() */
 
-void SendAriSym(const aritable *AriTable, int Symbol) {
+void SendAriSym(aricoder *Coder, const aritable *AriTable, int Symbol) {
 
-   SendAriRange(AriTable->AriSym[Symbol].CFreq,AriTable->AriSym[Symbol+1].CFreq,AriTable->AriSym[AriTable->N].CFreq);
+   SendAriRange(Coder,AriTable->AriSym[Symbol].CFreq,AriTable->AriSym[Symbol+1].CFreq,AriTable->AriSym[AriTable->N].CFreq);
 }
 
 /* SendAriRange() */
 
-void SendAriRange(int RangeLow, int RangeHigh, int RangeTot) {
+void SendAriRange(aricoder *Coder, int RangeLow, int RangeHigh, int RangeTot) {
 
    int Range;
 
-   Range = High - Low;
+   Range = Coder->High - Coder->Low;
 
-   High = Low + RangeHigh * Range / RangeTot;
-   Low  = Low + RangeLow  * Range / RangeTot;
+   Coder->High = Coder->Low + RangeHigh * Range / RangeTot;
+   Coder->Low  = Coder->Low + RangeLow  * Range / RangeTot;
 
    while (TRUE) {
 
-      if (High <= Half) {
-         BitPlusFollow(0);
-         Bpf = 0;
-      } else if (Low >= Half) {
-         BitPlusFollow(1);
-         Bpf = 0;
-         Low  -= Half;
-         High -= Half;
-      } else if (Low >= Quarter && High <= ThreeQuarters) {
-         Bpf++;
-         Low  -= Quarter;
-         High -= Quarter;
+      if (Coder->High <= Coder->Half) {
+         BitPlusFollow(Coder,0);
+         Coder->Bpf = 0;
+      } else if (Coder->Low >= Coder->Half) {
+         BitPlusFollow(Coder,1);
+         Coder->Bpf = 0;
+         Coder->Low  -= Coder->Half;
+         Coder->High -= Coder->Half;
+      } else if (Coder->Low >= Coder->Quarter && Coder->High <= Coder->ThreeQuarters) {
+         Coder->Bpf++;
+         Coder->Low  -= Coder->Quarter;
+         Coder->High -= Coder->Quarter;
       } else {
          break;
       }
 
-      Low  += Low;
-      High += High;
+      Coder->Low  += Coder->Low;
+      Coder->High += Coder->High;
    }
 }
 
-/* BitPlusFollow() */
+/* BitPlusFollow(Coder,) */
 
-static void BitPlusFollow(int Bit) {
+static void BitPlusFollow(aricoder *Coder, int Bit) {
 
-   SendBit(Bit);
-   for (; Bpf > 0; Bpf--) SendBit(1-Bit);
+   SendBit(Coder->Stream,Bit);
+   for (; Coder->Bpf > 0; Coder->Bpf--) SendBit(Coder->Stream,1-Bit);
 }
 
 /* GetStart() */
 
-void GetStart(void) {
+void GetStart(aricoder *Coder, stream *Stream) {
+
+   Coder->Stream = Stream;
 
-   One           = 1 << CODE_BIT;
-   Half          = One >> 1;
-   Quarter       = Half >> 1;
-   ThreeQuarters = Half + Quarter;
+   Coder->One           = 1 << CODE_BIT;
+   Coder->Half          = Coder->One >> 1;
+   Coder->Quarter       = Coder->Half >> 1;
+   Coder->ThreeQuarters = Coder->Half + Coder->Quarter;
 
-   Low  = 0;
-   High = One;
+   Coder->Low  = 0;
+   Coder->High = Coder->One;
 
-   Code = GetBits(CODE_BIT);
+   Coder->Code = GetBits(Coder->Stream,CODE_BIT);
 }
 
 /* GetEnd() */
 
-void GetEnd(void) {
+void GetEnd(aricoder *Coder) {
 
-   if (Low  != 0)   GetBit();
-   if (High != One) GetBit();
+   if (Coder->Low  != 0)   GetBit(Coder->Stream);
+   if (Coder->High != Coder->One) GetBit(Coder->Stream);
 }
 
 /* GetAriSym() */
 
-int GetAriSym(const aritable *AriTable) {
+int GetAriSym(aricoder *Coder, const aritable *AriTable) {
 
    int Range, NewCode, Symbol;
 
-   Range = High - Low;
+   Range = Coder->High - Coder->Low;
 
-   NewCode = GetAriRange(AriTable->AriSym[AriTable->N].CFreq);
+   NewCode = GetAriRange(Coder,AriTable->AriSym[AriTable->N].CFreq);
 
    for (Symbol = 0; NewCode >= AriTable->AriSym[Symbol+1].CFreq; Symbol++)
       ;
 
-   SkipAriRange(AriTable->AriSym[Symbol].CFreq,AriTable->AriSym[Symbol+1].CFreq,AriTable->AriSym[AriTable->N].CFreq);
+   SkipAriRange(Coder,AriTable->AriSym[Symbol].CFreq,AriTable->AriSym[Symbol+1].CFreq,AriTable->AriSym[AriTable->N].CFreq);
 
    return Symbol;
 }
 
 /* GetAriRange() */
 
-int GetAriRange(int SymTot) {
+int GetAriRange(const aricoder *Coder, int SymTot) {
 
-   return ((Code - Low + 1) * SymTot - 1) / (High - Low);
+   return ((Coder->Code - Coder->Low + 1) * SymTot - 1) / (Coder->High - Coder->Low);
 }
 
 /* SkipAriRange() */
 
-void SkipAriRange(int SymLow, int SymHigh, int SymTot) {
+void SkipAriRange(aricoder *Coder, int SymLow, int SymHigh, int SymTot) {
 
    int Range;
 
-   Range = High - Low;
+   Range = Coder->High - Coder->Low;
 
-   High = Low + SymHigh * Range / SymTot;
-   Low  = Low + SymLow  * Range / SymTot;
+   Coder->High = Coder->Low + SymHigh * Range / SymTot;
+   Coder->Low  = Coder->Low + SymLow  * Range / SymTot;
 
    while (TRUE) {
 
-      if (High <= Half) {
+      if (Coder->High <= Coder->Half) {
          ;
-      } else if (Low >= Half) {
-         Code -= Half;
-         Low  -= Half;
-         High -= Half;
-      } else if (Low >= Quarter && High <= ThreeQuarters) {
-         Code -= Quarter;
-         Low  -= Quarter;
-         High -= Quarter;
+      } else if (Coder->Low >= Coder->Half) {
+         Coder->Code -= Coder->Half;
+         Coder->Low  -= Coder->Half;
+         Coder->High -= Coder->Half;
+      } else if (Coder->Low >= Coder->Quarter && Coder->High <= Coder->ThreeQuarters) {
+         Coder->Code -= Coder->Quarter;
+         Coder->Low  -= Coder->Quarter;
+         Coder->High -= Coder->Quarter;
       } else {
          break;
       }
 
-      Code += Code + GetBit();
-      Low  += Low;
-      High += High;
+      Coder->Code += Coder->Code + GetBit(Coder->Stream);
+      Coder->Low  += Coder->Low;
+      Coder->High += Coder->High;
    }
 }
 
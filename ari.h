@@ -4,6 +4,8 @@
 #ifndef ARI_H
 #define ARI_H
 
+#include "bitio.h"
+
 /* Types */
 
 typedef struct {
@@ -16,6 +18,13 @@ typedef struct {
    arisym *AriSym;
 } aritable;
 
+typedef struct {
+   stream *Stream;
+   int     One, Half, Quarter, ThreeQuarters;
+   int     Low, High;
+   int     Bpf, Code;
+} aricoder;
+
 /* Prototypes */
 
 extern void AllocAriTable (aritable *AriTable, int N);
@@ -23,21 +32,21 @@ extern void FreeAriTable  (aritable *AriTable);
 
 extern void SetFreqs      (aritable *AriTable, const int Freq[]);
 
-extern void GetFreqs      (aritable *AriTable);
-extern void SendFreqs     (const aritable *AriTable);
+extern void GetFreqs      (stream *Stream, aritable *AriTable);
+extern void SendFreqs     (stream *Stream, const aritable *AriTable);
 
-extern void GetStart      (void);
-extern void GetEnd        (void);
+extern void GetStart      (aricoder *Coder, stream *Stream);
+extern void GetEnd        (aricoder *Coder);
 
-extern int  GetAriSym     (const aritable *AriTable);
-extern int  GetAriRange   (int SymTot);
-extern void SkipAriRange  (int SymLow, int SymHigh, int SymTot);
+extern int  GetAriSym     (aricoder *Coder, const aritable *AriTable);
+extern int  GetAriRange   (const aricoder *Coder, int SymTot);
+extern void SkipAriRange  (aricoder *Coder, int SymLow, int SymHigh, int SymTot);
 
-extern void SendStart     (void);
-extern void SendEnd       (void);
+extern void SendStart     (aricoder *Coder, stream *Stream);
+extern void SendEnd       (aricoder *Coder);
 
-extern void SendAriSym    (const aritable *AriTable, int Symbol);
-extern void SendAriRange  (int RangeLow, int RangeHigh, int RangeTot);
+extern void SendAriSym    (aricoder *Coder, const aritable *AriTable, int Symbol);
+extern void SendAriRange  (aricoder *Coder, int RangeLow, int RangeHigh, int RangeTot);
 
 #endif /* ! defined ARI_H */
 
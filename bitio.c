@@ -1,19 +1,124 @@
 
 /* BitIO.C */
 
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef POSIX
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "bitio.h"
 #include "types.h"
 #include "debug.h"
 
-/* Variables */
+/* Constants */
+
+#define HISTORY_SIZE 8 /* Bytes kept behind BufferPtr for CloseBitStream() */
+#define SIZE_LEN_BIT 6 /* Bit length of a size field, sizes are < 2^63 */
+
+/* Prototypes */
+
+static void   OpenStream  (stream *Stream, int Mode, FILE *File);
+static void   LoadStream  (stream *Stream, FILE *File);
+
+static int    FillBuffer  (stream *Stream);
+static void   FlushBuffer (stream *Stream);
+static void   GrowBuffer  (stream *Stream, int Size);
+static void   MakeRoom    (stream *Stream, int Size);
 
-stream InStream[1];
-stream OutStream[1];
+static void   FillBits    (stream *Stream);
+static void   FlushBits   (stream *Stream);
+
+static uint64 Load64      (const uchar *Buffer);
+static void   Store64     (uchar *Buffer, uint64 Word);
 
 /* Functions */
 
+/* OpenStream() */
+
+static void OpenStream(stream *Stream, int Mode, FILE *File) {
+
+   Stream->Type = STREAM_FILE;
+   Stream->Mode = Mode;
+   Stream->File = File;
+
+   Stream->BufferSize = STREAM_BUFFER_SIZE;
+   Stream->Buffer     = Nalloc(Stream->BufferSize,"Stream buffer");
+   Stream->IsOwner    = TRUE;
+   Stream->IsMapped   = FALSE;
+   Stream->BufferPos  = 0;
+   Stream->BufferPtr  = Stream->Buffer;
+   Stream->BufferMax  = Stream->Buffer;
+
+   if (Mode == STREAM_READ) {
+      Stream->BufferEnd = Stream->Buffer;
+   } else {
+      Stream->BufferEnd = Stream->Buffer + Stream->BufferSize;
+   }
+
+   Stream->Eof = FALSE;
+
+   Stream->IsBitStream = FALSE;
+   Stream->BitBuffer   = 0;
+   Stream->BitNb       = 0;
+}
+
+/* OpenMemStream() */
+
+void OpenMemStream(stream *Stream, int Mode, void *Buffer, int Size) {
+
+   assert(Mode==STREAM_READ||Mode==STREAM_WRITE);
+   assert(Size>=0);
+   assert(Buffer!=NULL||Mode==STREAM_WRITE);
+
+   Stream->Type = STREAM_MEMORY;
+   Stream->Mode = Mode;
+   Stream->File = NULL;
+
+   if (Buffer != NULL) {
+      Stream->Buffer  = Buffer;
+      Stream->IsOwner = FALSE;
+   } else { /* Growable output buffer */
+      if (Size < STREAM_BUFFER_MIN) Size = STREAM_BUFFER_MIN;
+      Stream->Buffer  = Nalloc(Size,"Memory stream");
+      Stream->IsOwner = TRUE;
+   }
+
+   Stream->IsMapped   = FALSE;
+   Stream->BufferSize = Size;
+   Stream->BufferPos  = 0;
+   Stream->BufferPtr  = Stream->Buffer;
+   Stream->BufferMax  = Stream->Buffer;
+   Stream->BufferEnd  = Stream->Buffer + Size;
+
+   Stream->Eof = FALSE;
+
+   Stream->IsBitStream = FALSE;
+   Stream->BitBuffer   = 0;
+   Stream->BitNb       = 0;
+}
+
+/* MemStreamData() */
+
+void *MemStreamData(stream *Stream, int *Size) {
+
+   assert(Stream->Type==STREAM_MEMORY);
+   assert(Size!=NULL);
+
+   if (Stream->Mode == STREAM_WRITE) {
+      if (Stream->BufferMax < Stream->BufferPtr) Stream->BufferMax = Stream->BufferPtr;
+      *Size = Stream->BufferMax - Stream->Buffer;
+   } else {
+      *Size = Stream->BufferEnd - Stream->Buffer;
+   }
+
+   return Stream->Buffer;
+}
+
 /* CloseStream() */
 
 void CloseStream(stream *Stream) {
@@ -22,8 +127,21 @@ void CloseStream(stream *Stream) {
    assert(Stream->Mode!=STREAM_NONE);
    assert(!Stream->IsBitStream);
 
-   fclose(Stream->File);
-   Stream->File = NULL;
+   if (Stream->Type == STREAM_FILE) {
+      if (Stream->Mode == STREAM_WRITE) FlushBuffer(Stream);
+      fclose(Stream->File);
+      Stream->File = NULL;
+   }
+
+#ifdef POSIX
+   if (Stream->IsMapped) munmap((void *)Stream->Buffer,(size_t)Stream->BufferSize);
+#endif
+
+   if (Stream->IsOwner) Free(Stream->Buffer);
+   Stream->Buffer    = NULL;
+   Stream->BufferEnd = NULL;
+   Stream->BufferPtr = NULL;
+   Stream->BufferMax = NULL;
 
    Stream->Type = STREAM_CLOSED;
    Stream->Mode = STREAM_NONE;
@@ -51,9 +169,14 @@ void CloseBitStream(stream *Stream) {
    assert(Stream->Mode!=STREAM_NONE);
    assert(Stream->IsBitStream);
 
-   if (Stream->Mode == STREAM_WRITE && Stream->BitNb != 0) {
-      fputc((int)(Stream->BitBuffer>>24),Stream->File);
-      Stream->ByteNb++;
+   if (Stream->Mode == STREAM_WRITE) {
+      FlushBits(Stream);
+      if (Stream->BitNb != 0) {
+         if (Stream->BufferPtr >= Stream->BufferEnd) MakeRoom(Stream,1);
+         *Stream->BufferPtr++ = (uchar) (Stream->BitBuffer >> 56);
+      }
+   } else {
+      Stream->BufferPtr -= Stream->BitNb >> 3; /* Give back unused bytes */
    }
 
    Stream->BitBuffer = 0;
@@ -62,120 +185,420 @@ void CloseBitStream(stream *Stream) {
    Stream->IsBitStream = FALSE;
 }
 
-/* OpenInStream() */
+/* SetStreamBuffer() */
 
-void OpenInStream(const char *FileName) {
+void SetStreamBuffer(stream *Stream, void *Buffer, int Size) {
 
-   stream *Stream;
+   assert(Stream->Type==STREAM_FILE);
+   assert(Stream->BufferPtr==Stream->Buffer);
+   assert(Stream->Mode!=STREAM_READ||Stream->BufferEnd==Stream->Buffer);
+   assert(Buffer!=NULL);
+   assert(Size>=STREAM_BUFFER_MIN);
 
-   Stream = InStream;
+   if (Stream->IsOwner) Free(Stream->Buffer);
 
-   Stream->ByteNb = 0;
+   Stream->Buffer     = Buffer;
+   Stream->BufferSize = Size;
+   Stream->IsOwner    = FALSE;
+   Stream->BufferPtr  = Stream->Buffer;
 
-   Stream->Type = STREAM_FILE;
-   Stream->Mode = STREAM_READ;
+   if (Stream->Mode == STREAM_READ) {
+      Stream->BufferEnd = Stream->Buffer;
+   } else {
+      Stream->BufferEnd = Stream->Buffer + Stream->BufferSize;
+   }
+}
+
+/* TellStream() */
+
+long TellStream(stream *Stream) {
+
+   assert(Stream->Type!=STREAM_CLOSED);
+   assert(!Stream->IsBitStream);
+
+   return Stream->BufferPos + (long) (Stream->BufferPtr - Stream->Buffer);
+}
+
+/* TellBits() */
+
+long TellBits(stream *Stream) {
+
+   assert(Stream->Type!=STREAM_CLOSED);
+   assert(Stream->Mode==STREAM_WRITE);
+   assert(Stream->IsBitStream);
+
+   return (Stream->BufferPos + (long) (Stream->BufferPtr - Stream->Buffer)) * 8 + Stream->BitNb;
+}
+
+/* SeekableStream() */
+
+int SeekableStream(stream *Stream) {
+
+#ifdef POSIX
+   struct stat Stat;
+#endif
+
+   assert(Stream->Type!=STREAM_CLOSED);
+
+   if (Stream->Type == STREAM_MEMORY) return TRUE;
+
+   /* Pipes, FIFOs and terminals fail, whatever their name (/dev/stdout, ...) */
+
+#ifdef POSIX
+   if (fstat(fileno(Stream->File),&Stat) != 0 || ! S_ISREG(Stat.st_mode)) return FALSE;
+#endif
+
+   return ftell(Stream->File) != -1L;
+}
+
+/* SeekStream() */
+
+int SeekStream(stream *Stream, long Pos) {
+
+   assert(Stream->Type!=STREAM_CLOSED);
+   assert(!Stream->IsBitStream);
+
+   Stream->Eof = FALSE;
+
+   if (Stream->Type == STREAM_MEMORY) {
+      if (Stream->BufferMax < Stream->BufferPtr) Stream->BufferMax = Stream->BufferPtr;
+      if (Pos < 0) return -1;
+      if (Stream->Mode == STREAM_READ  && Pos > Stream->BufferEnd - Stream->Buffer) return -1;
+      if (Stream->Mode == STREAM_WRITE && Pos > Stream->BufferMax - Stream->Buffer) return -1;
+      Stream->BufferPtr = Stream->Buffer + Pos;
+      return 0;
+   }
+
+   if (Stream->Mode == STREAM_READ
+    && Pos >= Stream->BufferPos
+    && Pos <= Stream->BufferPos + (long) (Stream->BufferEnd - Stream->Buffer)) {
+      Stream->BufferPtr = Stream->Buffer + (Pos - Stream->BufferPos);
+      return 0;
+   }
+
+   if (Stream->Mode == STREAM_WRITE) FlushBuffer(Stream);
+
+   if (fseek(Stream->File,Pos,SEEK_SET) != 0) return -1;
+
+   Stream->BufferPos = Pos;
+   Stream->BufferPtr = Stream->Buffer;
+   if (Stream->Mode == STREAM_READ) Stream->BufferEnd = Stream->Buffer;
+
+   return 0;
+}
+
+/* FillBuffer() */
+
+static int FillBuffer(stream *Stream) {
+
+   int Keep, Left, Size;
+   uchar *Start;
+
+   assert(Stream->Mode==STREAM_READ);
+
+   if (Stream->Type != STREAM_FILE) return 0;
+
+   Keep = Stream->BufferPtr - Stream->Buffer;
+   if (Keep > HISTORY_SIZE) Keep = HISTORY_SIZE;
+   Left = Stream->BufferEnd - Stream->BufferPtr;
+
+   Start = Stream->BufferPtr - Keep;
+   if (Start != Stream->Buffer) {
+      memmove(Stream->Buffer,Start,(size_t)(Keep+Left));
+      Stream->BufferPos += Start - Stream->Buffer;
+      Stream->BufferPtr  = Stream->Buffer + Keep;
+      Stream->BufferEnd  = Stream->BufferPtr + Left;
+   }
+
+   Size = fread(Stream->BufferEnd,1,(size_t)(Stream->BufferSize-(Keep+Left)),Stream->File);
+   Stream->BufferEnd += Size;
+
+   return Size;
+}
+
+/* FlushBuffer() */
+
+static void FlushBuffer(stream *Stream) {
+
+   int Size;
+
+   assert(Stream->Type==STREAM_FILE);
+   assert(Stream->Mode==STREAM_WRITE);
+
+   Size = Stream->BufferPtr - Stream->Buffer;
+
+   if (Size != 0 && (int) fwrite(Stream->Buffer,1,(size_t)Size,Stream->File) != Size) {
+      FatalError("FlushBuffer(): write error");
+   }
+
+   Stream->BufferPos += Size;
+   Stream->BufferPtr  = Stream->Buffer;
+}
+
+/* GrowBuffer() */
+
+static void GrowBuffer(stream *Stream, int Size) {
+
+   int Used, Max, NewSize;
+   uchar *Buffer;
+
+   assert(Stream->Type==STREAM_MEMORY);
+   assert(Stream->Mode==STREAM_WRITE);
+
+   if (Stream->BufferMax < Stream->BufferPtr) Stream->BufferMax = Stream->BufferPtr;
+
+   Used = Stream->BufferPtr - Stream->Buffer;
+   Max  = Stream->BufferMax - Stream->Buffer;
+
+   NewSize = Stream->BufferSize;
+   if (NewSize < STREAM_BUFFER_MIN) NewSize = STREAM_BUFFER_MIN;
+   while (NewSize - Used < Size) {
+      if (NewSize == INT_MAX) FatalError("Memory stream larger than 2 GB");
+      NewSize = (NewSize > INT_MAX / 2) ? INT_MAX : NewSize * 2;
+   }
+
+   if (Stream->IsOwner) {
+      Buffer = Realloc(Stream->Buffer,NewSize);
+   } else { /* Caller buffer too small => switch to our own */
+      Buffer = Nalloc(NewSize,"Memory stream");
+      memcpy(Buffer,Stream->Buffer,(size_t)Max);
+      Stream->IsOwner = TRUE;
+   }
+
+   Stream->Buffer     = Buffer;
+   Stream->BufferSize = NewSize;
+   Stream->BufferPtr  = Buffer + Used;
+   Stream->BufferMax  = Buffer + Max;
+   Stream->BufferEnd  = Buffer + NewSize;
+}
+
+/* MakeRoom() */
+
+static void MakeRoom(stream *Stream, int Size) {
+
+   if (Stream->Type == STREAM_FILE) {
+      FlushBuffer(Stream);
+   } else if (Stream->BufferEnd - Stream->BufferPtr < Size) {
+      GrowBuffer(Stream,Size);
+   }
+}
+
+/* FillBits() */
+
+static void FillBits(stream *Stream) {
+
+   if (Stream->BufferEnd - Stream->BufferPtr < 8) FillBuffer(Stream);
+
+   if (Stream->BufferEnd - Stream->BufferPtr >= 8) {
+
+      /* Bits below BitNb are the true upcoming bits, so OR-ing them again later is harmless */
+
+      Stream->BitBuffer |= Load64(Stream->BufferPtr) >> Stream->BitNb;
+      Stream->BufferPtr += (63 - Stream->BitNb) >> 3;
+      Stream->BitNb     |= 56;
 
-   if (FileName != NULL) {
-      Stream->File = fopen(FileName,"rb");
-      if (Stream->File == NULL) FatalError("Couldn't open file \"%s\" for reading",FileName);
    } else {
-      Stream->File = stdin;
+
+      while (Stream->BitNb <= 56 && Stream->BufferPtr < Stream->BufferEnd) {
+         Stream->BitBuffer |= (uint64) *Stream->BufferPtr++ << (56 - Stream->BitNb);
+         Stream->BitNb += 8;
+      }
    }
+}
 
-   Stream->IsBitStream = FALSE;
+/* FlushBits() */
+
+static void FlushBits(stream *Stream) {
+
+   int ByteNb;
+
+   if (Stream->BufferEnd - Stream->BufferPtr < 8) MakeRoom(Stream,8);
+
+   ByteNb = Stream->BitNb >> 3;
+
+   Store64(Stream->BufferPtr,Stream->BitBuffer);
+   Stream->BufferPtr += ByteNb;
+
+   Stream->BitBuffer = (ByteNb < 8) ? Stream->BitBuffer << (ByteNb * 8) : 0;
+   Stream->BitNb    -= ByteNb * 8;
 }
 
-/* EndOfFile() */
+/* Load64() */
 
-int EndOfFile(void) {
+static uint64 Load64(const uchar *Buffer) {
 
-   stream *Stream;
+   return (uint64) Buffer[0] << 56 | (uint64) Buffer[1] << 48
+        | (uint64) Buffer[2] << 40 | (uint64) Buffer[3] << 32
+        | (uint64) Buffer[4] << 24 | (uint64) Buffer[5] << 16
+        | (uint64) Buffer[6] <<  8 | (uint64) Buffer[7];
+}
 
-   Stream = InStream;
+/* Store64() */
 
-   return feof(Stream->File);
+static void Store64(uchar *Buffer, uint64 Word) {
+
+   Buffer[0] = (uchar) (Word >> 56);
+   Buffer[1] = (uchar) (Word >> 48);
+   Buffer[2] = (uchar) (Word >> 40);
+   Buffer[3] = (uchar) (Word >> 32);
+   Buffer[4] = (uchar) (Word >> 24);
+   Buffer[5] = (uchar) (Word >> 16);
+   Buffer[6] = (uchar) (Word >> 8);
+   Buffer[7] = (uchar) Word;
 }
 
-/* CloseInStream() */
+/* OpenInStream() */
+
+void OpenInStream(stream *Stream, const char *FileName) {
+
+   FILE *File;
 
-void CloseInStream(void) {
+   if (FileName != NULL) {
+      File = fopen(FileName,"rb");
+      if (File == NULL) FatalError("Couldn't open file \"%s\" for reading",FileName);
+   } else {
+      File = stdin;
+   }
 
-   CloseStream(InStream);
+   OpenStream(Stream,STREAM_READ,File);
 }
 
-/* OpenOutStream() */
+/* EndOfFile() */
 
-void OpenOutStream(const char *FileName) {
+int EndOfFile(stream *Stream) {
 
-   stream *Stream;
+   return Stream->Eof;
+}
 
-   Stream = OutStream;
+/* OpenOutStream() */
 
-   Stream->ByteNb = 0;
+void OpenOutStream(stream *Stream, const char *FileName) {
 
-   Stream->Type = STREAM_FILE;
-   Stream->Mode = STREAM_WRITE;
+   FILE *File;
 
    if (FileName != NULL) {
-      Stream->File = fopen(FileName,"wb");
-      if (Stream->File == NULL) FatalError("Couldn't open file \"%s\" for writing",FileName);
+      File = fopen(FileName,"wb");
+      if (File == NULL) FatalError("Couldn't open file \"%s\" for writing",FileName);
    } else {
-      Stream->File = stdout;
+      File = stdout;
    }
 
-   Stream->IsBitStream = FALSE;
+   OpenStream(Stream,STREAM_WRITE,File);
 }
 
 /* AppendOutStream() */
 
-void AppendOutStream(const char *FileName) {
+void AppendOutStream(stream *Stream, const char *FileName) {
 
-   stream *Stream;
+   FILE *File;
 
-   Stream = OutStream;
+   File = fopen(FileName,"rb+");
+   if (File == NULL) FatalError("Couldn't open file \"%s\" for appending",FileName);
 
-   Stream->ByteNb = 0;
+   fseek(File,0,SEEK_END);
 
-   Stream->Type = STREAM_FILE;
-   Stream->Mode = STREAM_WRITE;
+   OpenStream(Stream,STREAM_WRITE,File);
+
+   Stream->BufferPos = ftell(File);
+}
 
-   Stream->File = fopen(FileName,"rb+");
-   if (Stream->File == NULL) FatalError("Couldn't open file \"%s\" for appending",FileName);
+/* OpenMapStream() */
 
-   fseek(Stream->File,0,SEEK_END);
+int OpenMapStream(stream *Stream, const char *FileName) {
 
-   Stream->IsBitStream = FALSE;
+   FILE *File;
+#ifdef POSIX
+   struct stat Stat;
+   void *Map;
+#endif
+
+   if (FileName == NULL) { /* Standard input, can't be mapped nor sought */
+      LoadStream(Stream,stdin);
+      return TRUE;
+   }
+
+   File = fopen(FileName,"rb");
+   if (File == NULL) return FALSE;
+
+#ifdef POSIX
+
+   if (fstat(fileno(File),&Stat) == 0) {
+
+      if (! S_ISREG(Stat.st_mode)) { /* Pipe or device, can't be sought either */
+         LoadStream(Stream,File);
+         return TRUE;
+      }
+
+      /* Regular files are read straight from the page cache, as a memory stream */
+
+      if (Stat.st_size > 0 && Stat.st_size <= INT_MAX) {
+
+         /* Private and writable, so that in-place filters (delta) only copy the pages they touch */
+
+         Map = mmap(NULL,(size_t)Stat.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fileno(File),0);
+
+         if (Map != MAP_FAILED) {
+            fclose(File);
+            OpenMemStream(Stream,STREAM_READ,Map,(int)Stat.st_size);
+            Stream->IsMapped = TRUE;
+            return TRUE;
+         }
+      }
+   }
+
+#endif
+
+   OpenStream(Stream,STREAM_READ,File);
+
+   return TRUE;
 }
 
-/* CloseOutStream() */
+/* LoadStream() */
+
+static void LoadStream(stream *Stream, FILE *File) {
+
+   uchar *Buffer;
+   int Size, Max, Done;
 
-void CloseOutStream(void) {
+   /* Read everything up to EOF into an owned memory stream, of at most */
+   /* INT_MAX bytes like any memory stream (and archive member)         */
 
-   CloseStream(OutStream);
+   Size   = 0;
+   Max    = STREAM_BUFFER_SIZE;
+   Buffer = Nalloc(Max,"Stream buffer");
+
+   while ((Done = fread(Buffer+Size,1,Max-Size,File)) > 0) {
+      Size += Done;
+      if (Size == Max) {
+         if (Max == INT_MAX) FatalError("Standard input or pipe data larger than 2 GB");
+         Max    = (Max > INT_MAX / 2) ? INT_MAX : Max * 2;
+         Buffer = Realloc(Buffer,Max);
+      }
+   }
+
+   if (ferror(File)) Error("fread()");
+   fclose(File);
+
+   OpenMemStream(Stream,STREAM_READ,Buffer,Size);
+   Stream->IsOwner = TRUE;
 }
 
 /* GetBit() */
 
-int GetBit(void) {
+int GetBit(stream *Stream) {
 
-   stream *Stream;
    int Bit;
 
-   Stream = InStream;
-
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_READ);
    assert(Stream->IsBitStream);
 
    if (Stream->BitNb == 0) {
-      Bit = fgetc(Stream->File);
-      if (Bit == EOF) FatalError("GetBit(): unexpected EOF in input stream");
-      Stream->ByteNb++;
-      Stream->BitBuffer = (uint) Bit << 24;
-      Stream->BitNb     = 8;
+      FillBits(Stream);
+      if (Stream->BitNb == 0) FatalError("GetBit(): unexpected EOF in input stream");
    }
 
-   Bit = (int) (Stream->BitBuffer >> 31);
+   Bit = (int) (Stream->BitBuffer >> 63);
    Stream->BitBuffer <<= 1;
    Stream->BitNb--;
 
@@ -184,41 +607,64 @@ int GetBit(void) {
 
 /* GetBits() */
 
-int GetBits(int N) {
-
-   stream *Stream;
-   int Bits;
+uint64 GetBits(stream *Stream, int N) {
 
-   Stream = InStream;
+   uint64 Bits;
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_READ);
    assert(Stream->IsBitStream);
 
-   assert(N>0&&N<=25);
+   assert(N>0&&N<=57);
+
+   if (N > 32) { /* Wide field => two reads, high part first */
+      Bits = GetBits(Stream,N-32) << 32;
+      return Bits | GetBits(Stream,32);
+   }
 
-   while (Stream->BitNb < N) {
-      Bits = fgetc(Stream->File);
-      if (Bits == EOF) FatalError("GetBits(): unexpected EOF in input stream");
-      Stream->ByteNb++;
-      Stream->BitBuffer |= (uint) Bits << (24 - Stream->BitNb);
-      Stream->BitNb += 8;
+   if (Stream->BitNb < N) {
+      FillBits(Stream);
+      if (Stream->BitNb < N) FatalError("GetBits(): unexpected EOF in input stream");
    }
 
-   Bits = (int) (Stream->BitBuffer >> (32 - N));
+   Bits = Stream->BitBuffer >> (64 - N);
    Stream->BitBuffer <<= N;
    Stream->BitNb -= N;
 
    return Bits;
 }
 
-/* SendBit() */
+/* PeekBits() */
+
+uint PeekBits(stream *Stream, int N) {
+
+   assert(Stream->Type!=STREAM_CLOSED);
+   assert(Stream->Mode==STREAM_READ);
+   assert(Stream->IsBitStream);
+
+   assert(N>0&&N<=32);
+
+   if (Stream->BitNb < N) FillBits(Stream); /* Zero padded at EOF */
 
-void SendBit(int Bit) {
+   return (uint) (Stream->BitBuffer >> (64 - N));
+}
+
+/* ConsumeBits() */
+
+void ConsumeBits(stream *Stream, int N) {
+
+   assert(Stream->IsBitStream);
+   assert(N>=0&&N<=32);
+
+   if (Stream->BitNb < N) FatalError("ConsumeBits(): unexpected EOF in input stream");
+
+   Stream->BitBuffer <<= N;
+   Stream->BitNb -= N;
+}
 
-   stream *Stream;
+/* SendBit() */
 
-   Stream = OutStream;
+void SendBit(stream *Stream, int Bit) {
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_WRITE);
@@ -226,72 +672,90 @@ void SendBit(int Bit) {
 
    assert(Bit==0||Bit==1);
 
-   Stream->BitBuffer |= (uint) Bit << (31 - Stream->BitNb);
-   Stream->BitNb++;
+   if (Stream->BitNb >= 64) FlushBits(Stream);
 
-   if (Stream->BitNb >= 8) {
-      fputc((int)(Stream->BitBuffer>>24),Stream->File);
-      Stream->ByteNb++;
-      Stream->BitBuffer <<= 8;
-      Stream->BitNb -= 8;
-   }
+   Stream->BitBuffer |= (uint64) Bit << (63 - Stream->BitNb);
+   Stream->BitNb++;
 }
 
 /* SendBits() */
 
-void SendBits(int N, int Bits) {
-
-   stream *Stream;
-
-   Stream = OutStream;
+void SendBits(stream *Stream, int N, uint64 Bits) {
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_WRITE);
    assert(Stream->IsBitStream);
 
-   assert(N>0&&N<=25);
-   assert(Bits>=0&&Bits<(1<<N));
+   assert(N>0&&N<=57);
+   assert((Bits>>N)==0);
 
-/*
-   if (N > 25) {
-      if (Bits >= 1 << 25) FatalError("SendBits(): More then 25 bits");
-      do SendBit(0); while (--N > 25);
+   if (N > 32) { /* Wide field => two writes, high part first */
+      SendBits(Stream,N-32,Bits>>32);
+      N    = 32;
+      Bits = Bits & 0xFFFFFFFF;
    }
-*/
 
-   Stream->BitBuffer |= (uint) Bits << (32 - Stream->BitNb - N);
+   if (Stream->BitNb + N > 64) FlushBits(Stream);
+
+   Stream->BitBuffer |= Bits << (64 - Stream->BitNb - N);
    Stream->BitNb += N;
+}
 
-   while (Stream->BitNb >= 8) {
-      fputc((int)(Stream->BitBuffer>>24),Stream->File);
-      Stream->ByteNb++;
-      Stream->BitBuffer <<= 8;
-      Stream->BitNb -= 8;
-   }
+/* GetSize() */
+
+uint64 GetSize(stream *Stream) {
+
+   int N;
+   uint64 Size;
+
+   N = (int) GetBits(Stream,SIZE_LEN_BIT);
+   if (N == 0) return 0;
+
+   Size = 1; /* Leading one is implicit */
+
+   for (N--; N > 32; N -= 32) Size = Size << 32 | GetBits(Stream,32);
+   if (N > 0) Size = Size << N | GetBits(Stream,N);
+
+   return Size;
 }
 
-/* GetUInt8() */
+/* SendSize() */
 
-int GetUInt8(void) {
+void SendSize(stream *Stream, uint64 Size) {
 
-   stream *Stream;
+   int N, Len;
 
-   Stream = InStream;
+   assert((Size>>63)==0);
+
+   for (Len = 0; (Size >> Len) != 0; Len++)
+      ;
+
+   SendBits(Stream,SIZE_LEN_BIT,Len);
+   if (Len == 0) return;
+
+   for (N = Len - 1; N > 32; N -= 32) SendBits(Stream,32,(Size>>(N-32))&0xFFFFFFFF);
+   if (N > 0) SendBits(Stream,N,Size&(((uint64)1<<N)-1));
+}
+
+/* GetUInt8(Stream) */
+
+int GetUInt8(stream *Stream) {
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_READ);
    assert(!Stream->IsBitStream);
 
-   return fgetc(Stream->File);
+   if (Stream->BufferPtr >= Stream->BufferEnd && FillBuffer(Stream) == 0) {
+      Stream->Eof = TRUE;
+      return EOF;
+   }
+
+   return *Stream->BufferPtr++;
 }
 
 /* SendUInt8() */
 
-void SendUInt8(int UInt8) {
-
-   stream *Stream;
-
-   Stream = OutStream;
+void SendUInt8(stream *Stream, int UInt8) {
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_WRITE);
@@ -299,122 +763,136 @@ void SendUInt8(int UInt8) {
 
    assert(UInt8>=0x00&&UInt8<0x100);
 
-   fputc(UInt8,Stream->File);
+   if (Stream->BufferPtr >= Stream->BufferEnd) MakeRoom(Stream,1);
+
+   *Stream->BufferPtr++ = (uchar) UInt8;
 }
 
 /* GetUInt16() */
 
-int GetUInt16(void) {
-
-   stream *Stream;
-   int     UInt16;
-
-   Stream = InStream;
+int GetUInt16(stream *Stream) {
 
-   assert(Stream->Type!=STREAM_CLOSED);
-   assert(Stream->Mode==STREAM_READ);
-   assert(!Stream->IsBitStream);
+   int UInt16;
 
    UInt16 = 0;
    UInt16 <<= 8;
-   UInt16 |= fgetc(Stream->File);
+   UInt16 |= GetUInt8(Stream);
    UInt16 <<= 8;
-   UInt16 |= fgetc(Stream->File);
+   UInt16 |= GetUInt8(Stream);
 
    return UInt16;
 }
 
 /* SendUInt16() */
 
-void SendUInt16(int UInt16) {
-
-   stream *Stream;
-
-   Stream = OutStream;
-
-   assert(Stream->Type!=STREAM_CLOSED);
-   assert(Stream->Mode==STREAM_WRITE);
-   assert(!Stream->IsBitStream);
+void SendUInt16(stream *Stream, int UInt16) {
 
    assert(UInt16>=0x0000&&UInt16<0x10000);
 
-   fputc((UInt16>>8)&0xFF,Stream->File);
-   fputc(UInt16&0xFF,Stream->File);
+   SendUInt8(Stream,(UInt16>>8)&0xFF);
+   SendUInt8(Stream,UInt16&0xFF);
 }
 
 /* GetUInt32() */
 
-uint GetUInt32(void) {
+uint GetUInt32(stream *Stream) {
   
-   stream *Stream;
    uint UInt32;
 
-   Stream = InStream;
-
-   assert(Stream->Type!=STREAM_CLOSED);
-   assert(Stream->Mode==STREAM_READ);
-   assert(!Stream->IsBitStream);
-
    UInt32 = 0;
    UInt32 <<= 8;
-   UInt32 |= (uint) fgetc(Stream->File);
+   UInt32 |= (uint) GetUInt8(Stream);
    UInt32 <<= 8;
-   UInt32 |= (uint) fgetc(Stream->File);
+   UInt32 |= (uint) GetUInt8(Stream);
    UInt32 <<= 8;
-   UInt32 |= (uint) fgetc(Stream->File);
+   UInt32 |= (uint) GetUInt8(Stream);
    UInt32 <<= 8;
-   UInt32 |= (uint) fgetc(Stream->File);
+   UInt32 |= (uint) GetUInt8(Stream);
 
    return UInt32;
 }
 
 /* SendUInt32() */
 
-void SendUInt32(uint UInt32) {
+void SendUInt32(stream *Stream, uint UInt32) {
+
+   SendUInt8(Stream,(UInt32>>24)&0xFF);
+   SendUInt8(Stream,(UInt32>>16)&0xFF);
+   SendUInt8(Stream,(UInt32>>8)&0xFF);
+   SendUInt8(Stream,UInt32&0xFF);
+}
+
+/* GetBlock() */
 
-   stream *Stream;
+int GetBlock(stream *Stream, void *Block, int Size) {
 
-   Stream = OutStream;
+   uchar *Buffer;
+   int Done, Left;
 
    assert(Stream->Type!=STREAM_CLOSED);
-   assert(Stream->Mode==STREAM_WRITE);
+   assert(Stream->Mode==STREAM_READ);
    assert(!Stream->IsBitStream);
 
-   fputc((UInt32>>24)&0xFF,Stream->File);
-   fputc((UInt32>>16)&0xFF,Stream->File);
-   fputc((UInt32>>8)&0xFF,Stream->File);
-   fputc(UInt32&0xFF,Stream->File);
-}
+   if (Size <= 0) return 0;
 
-/* GetBlock() */
+   Buffer = Block;
 
-int GetBlock(void *Block, int Size) {
+   Done = Stream->BufferEnd - Stream->BufferPtr;
+   if (Done > Size) Done = Size;
 
-   stream *Stream;
+   memcpy(Buffer,Stream->BufferPtr,(size_t)Done);
+   Stream->BufferPtr += Done;
 
-   Stream = InStream;
+   while (Done < Size) {
 
-   assert(Stream->Type!=STREAM_CLOSED);
-   assert(Stream->Mode==STREAM_READ);
-   assert(!Stream->IsBitStream);
+      Left = Size - Done;
 
-   return fread(Block,1,Size,Stream->File);
-}
+      if (Stream->Type == STREAM_FILE && Left >= Stream->BufferSize) { /* Large read => bypass the buffer */
+         Left = fread(Buffer+Done,1,(size_t)Left,Stream->File);
+         Stream->BufferPos += (Stream->BufferEnd - Stream->Buffer) + Left;
+         Stream->BufferPtr  = Stream->Buffer;
+         Stream->BufferEnd  = Stream->Buffer;
+      } else {
+         if (FillBuffer(Stream) == 0) Left = 0;
+         if (Left > Stream->BufferEnd - Stream->BufferPtr) Left = Stream->BufferEnd - Stream->BufferPtr;
+         memcpy(Buffer+Done,Stream->BufferPtr,(size_t)Left);
+         Stream->BufferPtr += Left;
+      }
 
-/* SendBlock() */
+      if (Left == 0) {
+         Stream->Eof = TRUE;
+         break;
+      }
+
+      Done += Left;
+   }
 
-void SendBlock(const void *Block, int Size) {
+   return Done;
+}
 
-   stream *Stream;
+/* SendBlock() */
 
-   Stream = OutStream;
+void SendBlock(stream *Stream, const void *Block, int Size) {
 
    assert(Stream->Type!=STREAM_CLOSED);
    assert(Stream->Mode==STREAM_WRITE);
    assert(!Stream->IsBitStream);
 
-   fwrite(Block,1,Size,Stream->File);
+   if (Size <= 0) return;
+
+   if (Size > Stream->BufferEnd - Stream->BufferPtr) {
+
+      MakeRoom(Stream,Size);
+
+      if (Stream->Type == STREAM_FILE && Size >= Stream->BufferSize) { /* Large write => bypass the buffer */
+         if ((int) fwrite(Block,1,(size_t)Size,Stream->File) != Size) FatalError("SendBlock(): write error");
+         Stream->BufferPos += Size;
+         return;
+      }
+   }
+
+   memcpy(Stream->BufferPtr,Block,(size_t)Size);
+   Stream->BufferPtr += Size;
 }
 
 /* End of BitIO.C */
-
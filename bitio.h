@@ -10,6 +10,9 @@
 
 /* Constants */
 
+#define STREAM_BUFFER_SIZE 65536 /* Default buffer size */
+#define STREAM_BUFFER_MIN  64
+
 enum { STREAM_CLOSED, STREAM_MEMORY, STREAM_FILE  }; /* Type Field */
 enum { STREAM_NONE,   STREAM_READ,   STREAM_WRITE }; /* Mode Field */
 
@@ -20,50 +23,65 @@ typedef struct {
    int    Mode;
    FILE  *File;
    uchar *Buffer;
-   uchar *BufferEnd;
+   uchar *BufferEnd;   /* End of valid data (read) or of free space (write) */
+   uchar *BufferPtr;   /* Next byte to read or write */
+   int    BufferSize;
+   int    IsOwner;     /* Buffer allocated by the stream itself */
+   int    IsMapped;    /* Buffer is a private mapping of the file */
+   long   BufferPos;   /* File position of Buffer[0] */
+   uchar *BufferMax;   /* High water mark of a memory output stream */
+   int    Eof;
    int    IsBitStream;
-   uint   BitBuffer;
+   uint64 BitBuffer;   /* MSB aligned */
    int    BitNb;
-   int    ByteNb;
 } stream;
 
-/* Variables */
+/* Prototypes */
+
+extern void   OpenInStream    (stream *Stream, const char *FileName); /* stdin  if NULL */
+extern void   OpenOutStream   (stream *Stream, const char *FileName); /* stdout if NULL */
+extern void   AppendOutStream (stream *Stream, const char *FileName);
+extern int    OpenMapStream   (stream *Stream, const char *FileName); /* stdin  if NULL */
 
-extern stream InStream[1];
-extern stream OutStream[1];
+extern void   OpenMemStream   (stream *Stream, int Mode, void *Buffer, int Size);
+extern void  *MemStreamData   (stream *Stream, int *Size);
 
-/* Prototypes */
+extern void   CloseStream     (stream *Stream);
+extern int    EndOfFile       (stream *Stream);
 
-extern void CloseStream     (stream *Stream);
-extern void OpenBitStream   (stream *Stream);
-extern void CloseBitStream  (stream *Stream);
+extern void   OpenBitStream   (stream *Stream);
+extern void   CloseBitStream  (stream *Stream);
 
-extern void OpenInStream    (const char *FileName); /* stdin  if NULL */
-extern int  EndOfFile       (void);
-extern void CloseInStream   (void);
+extern void   SetStreamBuffer (stream *Stream, void *Buffer, int Size);
 
-extern void OpenOutStream   (const char *FileName); /* stdout if NULL */
-extern void AppendOutStream (const char *FileName);
-extern void CloseOutStream  (void);
+extern long   TellStream      (stream *Stream);
+extern long   TellBits        (stream *Stream);
+extern int    SeekStream      (stream *Stream, long Pos);
+extern int    SeekableStream  (stream *Stream);
 
-extern int  GetBit          (void);
-extern int  GetBits         (int N);
+extern int    GetBit          (stream *Stream);
+extern uint64 GetBits         (stream *Stream, int N); /* N <= 57 */
 
-extern void SendBit         (int Bit);
-extern void SendBits        (int N, int Bits);
+extern uint   PeekBits        (stream *Stream, int N);
+extern void   ConsumeBits     (stream *Stream, int N);
 
-extern int  GetUInt8        (void);
-extern int  GetUInt16       (void);
-extern uint GetUInt32       (void);
+extern void   SendBit         (stream *Stream, int Bit);
+extern void   SendBits        (stream *Stream, int N, uint64 Bits); /* N <= 57 */
 
-extern void SendUInt8       (int UInt8);
-extern void SendUInt16      (int UInt16);
-extern void SendUInt32      (uint UInt32);
+extern uint64 GetSize         (stream *Stream);
+extern void   SendSize        (stream *Stream, uint64 Size);
 
-extern int  GetBlock        (void *Block, int Size);
-extern void SendBlock       (const void *Block, int Size);
+extern int    GetUInt8        (stream *Stream);
+extern int    GetUInt16       (stream *Stream);
+extern uint   GetUInt32       (stream *Stream);
+
+extern void   SendUInt8       (stream *Stream, int UInt8);
+extern void   SendUInt16      (stream *Stream, int UInt16);
+extern void   SendUInt32      (stream *Stream, uint UInt32);
+
+extern int    GetBlock        (stream *Stream, void *Block, int Size);
+extern void   SendBlock       (stream *Stream, const void *Block, int Size);
 
 #endif /* ! defined BITIO_H */
 
 /* End of BitIO.H */
-
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "bwt.h"
 #include "types.h"
@@ -12,267 +13,826 @@
 #include "hufblock.h"
 #include "mtf.h"
 #include "rle.h"
+#include "thread.h"
+
+/* Constants */
+
+#define CHAINS     8        /* Interleaved inverse BWT chains, version 3 framing */
+#define PACK_MAX   (1 << 24) /* Largest block with row and byte in one word, >= CHUNK_SIZE */
+#define SORT_MIN   (1 << 18) /* Smallest block sorted with several threads */
+#define SORT_THREADS 3       /* Fewest threads that pay for SortLMS() merging */
+#define PAIR_NB    65536     /* LMS buckets by first two bytes */
+#define MERGE_MIN  16        /* Insertion sort below */
+
+#define TYPE_S(I)  ((Type[(I)>>3] >> ((I)&7)) & 1)            /* T[I..] < T[I+1..] */
+#define IS_LMS(I)  ((I) > 0 && TYPE_S(I) && ! TYPE_S((I)-1))  /* Leftmost S-type */
+#define SYMBOL(I)  ((Cs == 1) ? ((const uchar *)T)[I] : ((const int *)T)[I])
+
+/* Types */
+
+typedef struct {
+   uchar *S;
+   int    N;
+   int    Index;
+   int    Chains;
+   int    Start[CHAINS]; /* Rows of the text positions ending the chains */
+   uchar *L;
+   int   *Pos;           /* Sorted rotations */
+   int    C[256];
+   uint  *P;             /* LF mapping, with L[] packed in if N <= PACK_MAX */
+   int    Threads;       /* Suffix sorting threads */
+} bwt;
+
+typedef struct {
+   thread        Thread[1];
+   const codec  *Main;
+   int           First;    /* Chunks First, First+Step, ... */
+   int           Step;
+   int           ChunkSize;
+   int           ChunkNb;
+   stream       *Chunk;    /* Crunched chunks, as bit streams */
+   long         *BitNb;
+} worker;
+
+typedef struct {
+   thread        Thread[1];
+   const uchar  *T;
+   const uchar  *Type;
+   int           N;
+   int          *SA;       /* LMS positions, by bucket */
+   int          *Temp;     /* Merge space, same layout */
+   const int    *Start;    /* Bucket starts, PAIR_NB+1 */
+   semaphore    *Lock;
+   int          *Next;     /* First bucket not yet taken */
+} sorter;
 
-/* Variables */
-
-int    Index;
-uchar *L;
-
-static int   *Pos, *Prm, *Count;
-static uchar *BH, *B2H;
+/* Prototypes */
 
-static int    C[256], *P;
+static void CodeChunk   (codec *Codec);
+static void DecodeChunk (codec *Codec);
+static void WorkBWT     (void *Data);
+static void SendChunk   (stream *Out, stream *Chunk, long BitNb);
 
-/* Prototypes */
+static void InitBWT     (bwt *Bwt, const codec *Codec);
 
-static void AllocSuffix (void);
-static void FreeSuffix  (void);
+static void AllocSuffix (bwt *Bwt);
+static void FreeSuffix  (bwt *Bwt);
                         
-static void AllocLast   (void);
-static void FreeLast    (void);
+static void AllocLast   (bwt *Bwt);
+static void FreeLast    (bwt *Bwt);
                         
-static void AllocArray  (void);
-static void FreeArray   (void);
+static void AllocArray  (bwt *Bwt);
+static void FreeArray   (bwt *Bwt);
                         
-static void SortSuffix  (void);
+static void SortSuffix  (bwt *Bwt);
+static int  LeastRotation (const uchar *S, int N, int *Period);
+
+static void SortSuffixIS (const void *T, int *SA, int Fs, int N, int K, int Cs, int Threads);
+static int  SortLMS      (const uchar *T, int *SA, const uchar *Type, int N, int ThreadNb);
+static void WorkLMS      (void *Data);
+static void MergeLMS     (const sorter *Sorter, int *A, int *Temp, int Size);
+static int  CompareLMS   (const uchar *T, const uchar *Type, int N, int P, int Q);
+static void GetBuckets   (const void *T, int *Bucket, int N, int K, int Cs, int End);
+static void InduceL      (const void *T, int *SA, int *Bucket, const uchar *Type, int N, int K, int Cs);
+static void InduceS      (const void *T, int *SA, int *Bucket, const uchar *Type, int N, int K, int Cs);
                         
-static void CompLast    (void);
-static void CompFirst   (void);
-static void CompBlock   (void);
+static void CompLast    (bwt *Bwt);
+static void CompFirst   (bwt *Bwt);
+static void CompBlock   (bwt *Bwt);
                         
 /* Functions */
 
 /* CodeBWT() */
 
-void CodeBWT(void) {
+void CodeBWT(codec *Codec) {
+
+   int I, K, ChunkSize, ChunkNb, ThreadNb;
+   long *BitNb;
+   codec Part[1];
+   stream *Chunk;
+   worker *Worker;
+
+   if (Codec->Version < 4) {
+      CodeChunk(Codec);
+      return;
+   }
+
+   /* Fixed-size chunks, each sorted and coded on its own, so that a big */
+   /* archive member has bounded sort memory; with several threads they  */
+   /* are crunched concurrently, then sent in order                     */
+
+   ChunkSize = (Codec->Block != 0) ? Codec->Block : CHUNK_SIZE;
+   ChunkNb   = Codec->N / ChunkSize + (Codec->N % ChunkSize != 0);
+
+   SendLength(Codec,ChunkSize);
+
+   ThreadNb = (ThreadSupport()) ? Codec->Threads : 1;
+   if (ThreadNb > ChunkNb) ThreadNb = ChunkNb;
+
+   if (ThreadNb <= 1) {
+
+      *Part = *Codec;
+
+      for (K = 0; K < ChunkNb; K++) {
+         Part->S = &Codec->S[K*ChunkSize];
+         Part->N = (Codec->N - K * ChunkSize > ChunkSize) ? ChunkSize : Codec->N - K * ChunkSize;
+         CodeChunk(Part);
+      }
 
-   AllocSuffix();
-   SortSuffix();
-   AllocLast();
-   CompLast();
-   FreeSuffix();
+      return;
+   }
 
-   if (Verbosity >= 2) fprintf(stderr,"I = %d\n",Index);
+   if (Codec->Verbosity >= 2) fprintf(stderr,"%d chunks of %d bytes, %d threads\n",ChunkNb,ChunkSize,ThreadNb);
+
+   Chunk  = Nalloc(ChunkNb*sizeof(stream),"BWT chunks");
+   BitNb  = Nalloc(ChunkNb*sizeof(long),"BWT chunk sizes");
+   Worker = Nalloc(ThreadNb*sizeof(worker),"BWT workers");
+
+   for (I = 0; I < ThreadNb; I++) {
+      Worker[I].Main      = Codec;
+      Worker[I].First     = I;
+      Worker[I].Step      = ThreadNb;
+      Worker[I].ChunkSize = ChunkSize;
+      Worker[I].ChunkNb   = ChunkNb;
+      Worker[I].Chunk     = Chunk;
+      Worker[I].BitNb     = BitNb;
+      StartThread(Worker[I].Thread,&WorkBWT,&Worker[I]);
+   }
 
-   SendBits(25,Index);
+   for (I = 0; I < ThreadNb; I++) JoinThread(Worker[I].Thread);
 
-   CodeMTF(L,N);
+   for (K = 0; K < ChunkNb; K++) {
+      SendChunk(Codec->Out,&Chunk[K],BitNb[K]);
+      CloseStream(&Chunk[K]);
+   }
 
-   AllocHufBlock();
-   CodeRLE();
-   SendHufBlock();
-   FreeHufBlock();
-   FreeLast();
+   Free(Worker);
+   Free(BitNb);
+   Free(Chunk);
 }
 
 /* DecodeBWT() */
 
-void DecodeBWT(void) {
+void DecodeBWT(codec *Codec) {
+
+   int K, ChunkSize, ChunkNb;
+   codec Part[1];
 
-   Index = GetBits(25);
-   if (Verbosity >= 2) fprintf(stderr,"I = %d\n",Index);
+   if (Codec->Version < 4) {
+      DecodeChunk(Codec);
+      return;
+   }
+
+   ChunkSize = GetLength(Codec);
+   if (ChunkSize <= 0) FatalError("Bad BWT chunk size");
 
-   AllocLast();
-   AllocHufBlock();
-   GetHufBlock();
-   DecodeRLE();
-   FreeHufBlock();
+   ChunkNb = Codec->N / ChunkSize + (Codec->N % ChunkSize != 0);
 
-   DecodeMTF(L,N);
+   *Part = *Codec;
 
-   AllocArray();
-   CompFirst();
-   CompBlock();
-   FreeArray();
-   FreeLast();
+   for (K = 0; K < ChunkNb; K++) {
+      Part->S = &Codec->S[K*ChunkSize];
+      Part->N = (Codec->N - K * ChunkSize > ChunkSize) ? ChunkSize : Codec->N - K * ChunkSize;
+      DecodeChunk(Part);
+   }
 }
 
-/* AllocSuffix() */
+/* WorkBWT() */
 
-static void AllocSuffix(void) {
+static void WorkBWT(void *Data) {
 
-   Pos = malloc(N*sizeof(int));
-   if (Pos == NULL) FatalError("AllocSuffix(): Not enough memory");
+   int K;
+   worker *Worker;
+   codec Part[1];
 
-   Prm = malloc(N*sizeof(int));
-   if (Prm == NULL) FatalError("AllocSuffix(): Not enough memory");
+   Worker = Data;
 
-   Count = malloc(N*sizeof(int));
-   if (Count == NULL) FatalError("AllocSuffix(): Not enough memory");
+   *Part = *Worker->Main;
+   Part->Verbosity = 0;
 
-   BH = malloc((size_t)N);
-   if (BH == NULL) FatalError("AllocSuffix(): Not enough memory");
+   for (K = Worker->First; K < Worker->ChunkNb; K += Worker->Step) {
 
-   B2H = malloc((size_t)N);
-   if (B2H == NULL) FatalError("AllocSuffix(): Not enough memory");
-}
+      Part->S   = &Worker->Main->S[K*Worker->ChunkSize];
+      Part->N   = (Worker->Main->N - K * Worker->ChunkSize > Worker->ChunkSize) ? Worker->ChunkSize : Worker->Main->N - K * Worker->ChunkSize;
+      Part->Out = &Worker->Chunk[K];
+      Part->Threads = 1; /* Already one per chunk */
 
-/* FreeSuffix() */
+      OpenMemStream(Part->Out,STREAM_WRITE,NULL,Part->N/4);
+      OpenBitStream(Part->Out);
 
-static void FreeSuffix(void) {
+      CodeChunk(Part);
 
-   if (Pos != NULL) {
-      free(Pos);
-      Pos = NULL;
+      Worker->BitNb[K] = TellBits(Part->Out);
+      CloseBitStream(Part->Out);
    }
+}
 
-   if (Prm != NULL) {
-      free(Prm);
-      Prm = NULL;
-   }
+/* SendChunk() */
 
-   if (Count != NULL) {
-      free(Count);
-      Count = NULL;
-   }
+static void SendChunk(stream *Out, stream *Chunk, long BitNb) {
+
+   int Size;
+   void *Data;
+   stream Block[1];
+
+   /* Bit copy, the chunk was crunched at bit 0 of its own stream */
 
-   if (BH != NULL) {
-      free(BH);
-      BH = NULL;
+   Data = MemStreamData(Chunk,&Size);
+
+   OpenMemStream(Block,STREAM_READ,Data,Size);
+   OpenBitStream(Block);
+
+   for (; BitNb >= 32; BitNb -= 32) SendBits(Out,32,GetBits(Block,32));
+   if (BitNb != 0) SendBits(Out,(int)BitNb,GetBits(Block,(int)BitNb));
+
+   CloseBitStream(Block);
+   CloseStream(Block);
+}
+
+/* CodeChunk() */
+
+static void CodeChunk(codec *Codec) {
+
+   bwt Bwt[1];
+   int J;
+   hufblock HufBlock[1];
+
+   InitBWT(Bwt,Codec);
+
+   AllocSuffix(Bwt);
+   SortSuffix(Bwt);
+   AllocLast(Bwt);
+   CompLast(Bwt);
+   FreeSuffix(Bwt);
+
+   if (Codec->Verbosity >= 2) fprintf(stderr,"I = %d\n",Bwt->Index);
+
+   SendLength(Codec,Bwt->Index);
+   for (J = 0; J < Bwt->Chains-1; J++) SendLength(Codec,Bwt->Start[J]);
+
+   CodeMTF(Bwt->L,Bwt->N);
+
+   AllocHufBlock(HufBlock,Bwt->N);
+   CodeRLE(HufBlock,Bwt->L,Bwt->N);
+   SendHufBlock(Codec,HufBlock);
+   FreeHufBlock(HufBlock);
+   FreeLast(Bwt);
+}
+
+/* DecodeChunk() */
+
+static void DecodeChunk(codec *Codec) {
+
+   bwt Bwt[1];
+   int J;
+   hufblock HufBlock[1];
+
+   InitBWT(Bwt,Codec);
+
+   Bwt->Index = GetLength(Codec);
+   if (Codec->Verbosity >= 2) fprintf(stderr,"I = %d\n",Bwt->Index);
+
+   for (J = 0; J < Bwt->Chains-1; J++) {
+      Bwt->Start[J] = GetLength(Codec);
+      if (Bwt->Start[J] >= Bwt->N && Bwt->Start[J] != 0) FatalError("Bad BWT chain start");
    }
 
-   if (B2H != NULL) {
-      free(B2H);
-      B2H = NULL;
+   AllocLast(Bwt);
+   AllocHufBlock(HufBlock,Bwt->N);
+   GetHufBlock(Codec,HufBlock);
+   DecodeRLE(Bwt->L,Bwt->N,HufBlock);
+   FreeHufBlock(HufBlock);
+
+   DecodeMTF(Bwt->L,Bwt->N);
+
+   AllocArray(Bwt);
+   CompFirst(Bwt);
+   CompBlock(Bwt);
+   FreeArray(Bwt);
+   FreeLast(Bwt);
+}
+
+/* InitBWT() */
+
+static void InitBWT(bwt *Bwt, const codec *Codec) {
+
+   int J;
+
+   Bwt->S      = Codec->S;
+   Bwt->N      = Codec->N;
+   Bwt->Index  = 0;
+   Bwt->Chains = (Codec->Version >= 3) ? CHAINS : 1;
+   Bwt->Threads = (ThreadSupport() && Codec->N >= SORT_MIN) ? Codec->Threads : 1;
+
+   for (J = 0; J < CHAINS; J++) Bwt->Start[J] = 0;
+
+   Bwt->L     = NULL;
+   Bwt->Pos   = NULL;
+   Bwt->P     = NULL;
+}
+
+/* AllocSuffix() */
+
+static void AllocSuffix(bwt *Bwt) {
+
+   Bwt->Pos = malloc(Bwt->N*sizeof(int));
+   if (Bwt->Pos == NULL) FatalError("AllocSuffix(): Not enough memory");
+}
+
+/* FreeSuffix() */
+
+static void FreeSuffix(bwt *Bwt) {
+
+   if (Bwt->Pos != NULL) {
+      free(Bwt->Pos);
+      Bwt->Pos = NULL;
    }
 }
 
 /* AllocLast() */
 
-static void AllocLast(void) {
+static void AllocLast(bwt *Bwt) {
 
-   L = malloc((size_t)N);
-   if (L == NULL) FatalError("AllocLast(): Not enough memory");
+   Bwt->L = malloc((size_t)Bwt->N);
+   if (Bwt->L == NULL) FatalError("AllocLast(): Not enough memory");
 }
 
 /* FreeLast() */
 
-static void FreeLast(void) {
+static void FreeLast(bwt *Bwt) {
 
-   if (L != NULL) {
-      free(L);
-      L = NULL;
+   if (Bwt->L != NULL) {
+      free(Bwt->L);
+      Bwt->L = NULL;
    }
 }
 
 /* AllocArray() */
 
-static void AllocArray(void) {
+static void AllocArray(bwt *Bwt) {
 
-   P = malloc((size_t)(N*sizeof(int)));
-   if (P == NULL) FatalError("AllocArray(): Not enough memory");
+   Bwt->P = malloc((size_t)(Bwt->N*sizeof(uint)));
+   if (Bwt->P == NULL) FatalError("AllocArray(): Not enough memory");
 }
 
 /* FreeArray() */
 
-static void FreeArray(void) {
+static void FreeArray(bwt *Bwt) {
 
-   if (P != NULL) {
-      free(P);
-      P = NULL;
+   if (Bwt->P != NULL) {
+      free(Bwt->P);
+      Bwt->P = NULL;
    }
 }
 
 /* SortSuffix() */
 
-static void SortSuffix(void) {
+static void SortSuffix(bwt *Bwt) {
+
+   int I, J, N, R, Period, Group, Sum, First;
+   long H;
+   int *Pos;
+   uchar *T;
+   const uchar *S;
+
+   S   = Bwt->S;
+   N   = Bwt->N;
+   Pos = Bwt->Pos;
+
+   if (N == 0) return;
+
+   /* The least rotation of a primitive block is a Lyndon word, whose */
+   /* suffixes sort in the same order as its rotations                */
+
+   R = LeastRotation(S,N,&Period);
 
-   int I, J, B, D, H, L, P, R;
-   int Bucket[256+1];
+   T = malloc((size_t)N);
+   if (T == NULL) FatalError("SortSuffix(): Not enough memory");
 
-   for (I = 0; I <= 256; I++) Bucket[I] = 0;
-   for (I = 0; I <  N;   I++) Bucket[S[I]+1]++;
-   for (I = 1; I <= 256; I++) Bucket[I] += Bucket[I-1];
+   for (I = R; I < N; I++) T[I-R] = S[I];
+   for (I = 0; I < R; I++) T[N-R+I] = S[I];
+
+   SortSuffixIS(T,Pos,0,N,256,1,Bwt->Threads);
+
+   free(T);
 
    for (I = 0; I < N; I++) {
-      Prm[I] = Bucket[S[I]];
-      Pos[Prm[I]] = I;
-      Bucket[S[I]]++;
+      Pos[I] += R;
+      if (Pos[I] >= N) Pos[I] -= N;
    }
 
-   BH[0] = TRUE;
-   for (I = 1; I < N; I++) BH[I] = S[Pos[I]] != S[Pos[I-1]];
+   /* A periodic block has groups of equal rotations, ordered as the */
+   /* former prefix doubling sort did (it shifted them by each step) */
+   /* so that Index doesn't change                                  */
 
-   for (H = 1; H < 2*N; H *= 2) {
+   if (Period < N) {
 
-      B = 0; /* To avoid warnings */
-      for (I = 0; I < N; I++) {
-         if (BH[I]) {
-            B = I;
-            Count[B] = 0;
+      for (Sum = 0, H = 1; H < 2 * (long) N; H *= 2) Sum = (int) ((Sum + H) % N);
+
+      Group = N / Period;
+
+      for (I = 0; I < N; I += Group) {
+         First = (Pos[I] + Sum) % Period;
+         for (J = 0; J < Group; J++) Pos[I+J] = (First + J * Period - Sum + N) % N;
+      }
+   }
+}
+
+/* LeastRotation() */
+
+static int LeastRotation(const uchar *S, int N, int *Period) {
+
+   int I, J, K, A, B, D;
+
+   /* Two candidates compared character by character, the loser skips */
+   /* past the compared part; they only tie all along if S is periodic */
+
+   I = 0;
+   J = 1;
+   K = 0;
+
+   while (I < N && J < N && K < N) {
+
+      A = S[(I+K < N) ? I+K : I+K-N];
+      B = S[(J+K < N) ? J+K : J+K-N];
+
+      if (A == B) {
+         K++;
+      } else {
+         if (A > B) {
+            I += K + 1;
+         } else {
+            J += K + 1;
          }
-         Prm[Pos[I]] = B;
-         B2H[I] = FALSE;
+         if (I == J) J++;
+         K = 0;
       }
+   }
 
-      for (L = 0; L < N; L = R) {
+   *Period = N;
 
-         for (R = L+1; R < N && ! BH[R]; R++)
+   if (K >= N) { /* Smallest period dividing the shift between the two */
+      D = (I > J) ? I - J : J - I;
+      for (*Period = 1; *Period < D; (*Period)++) {
+         if (D % *Period != 0) continue;
+         for (K = *Period; K < N && S[K] == S[K-*Period]; K++)
             ;
+         if (K == N) break;
+      }
+   }
 
-         for (I = L; I < R; I++) {
+   return (I < J) ? I : J;
+}
 
-            D = Pos[I] - H;
-            if (D < 0) D += N;
-            if (D < 0) D += N;
+/* SortSuffixIS() */
 
-            B = Prm[D];
-            P = B + Count[B];
+static void SortSuffixIS(const void *T, int *SA, int Fs, int N, int K, int Cs, int Threads) {
 
-            Prm[D] = P;
-            B2H[P] = TRUE;
+   int I, J, P, Q, D, N1, Name, Diff, *Bucket, *S1;
+   uchar *Type;
 
-            Count[B]++;
-         }
+   /* Suffix array by induced sorting (Nong, Zhang & Chan's SA-IS): the */
+   /* leftmost S-type suffixes are sorted, recursively if needed, then  */
+   /* give the order of all the others. T[N] is a virtual sentinel,     */
+   /* smaller than any symbol. Symbols are bytes (Cs = 1) or, for the   */
+   /* reduced strings, ints below K. Fs ints after SA[N] are free. The  */
+   /* suffix array is unique, so sorting the LMS substrings by threads  */
+   /* (SortLMS()) instead of inducing them gives the same result        */
+
+   if (N == 1) {
+      SA[0] = 0;
+      return;
+   }
 
-         for (I = L; I < R; I++) {
+   Type = malloc((size_t)(N/8+1));
+   if (Type == NULL) FatalError("SortSuffixIS(): Not enough memory");
 
-            D = Pos[I] - H;
-            if (D < 0) D += N;
-            if (D < 0) D += N;
+   Type[(N-1)>>3] = 0;
+   for (I = N-2; I >= 0; I--) {
+      if ((I & 7) == 7) Type[I>>3] = 0;
+      if (SYMBOL(I) < SYMBOL(I+1) || (SYMBOL(I) == SYMBOL(I+1) && TYPE_S(I+1))) Type[I>>3] |= 1 << (I & 7);
+      else Type[I>>3] &= ~(1 << (I & 7));
+   }
+
+   /* Sort the LMS substrings: seeds at their bucket ends, then induce */
+
+   if (Threads >= SORT_THREADS && Cs == 1) {
+
+      N1 = SortLMS(T,SA,Type,N,Threads);
+
+   } else {
+
+      if (K <= Fs) {
+         Bucket = &SA[N];
+      } else {
+         Bucket = malloc(K*sizeof(int));
+         if (Bucket == NULL) FatalError("SortSuffixIS(): Not enough memory");
+      }
 
-            P = Prm[D];
+      GetBuckets(T,Bucket,N,K,Cs,TRUE);
 
-            if (B2H[P]) {
-               for (J = P+1; ! BH[J] && B2H[J]; J++) B2H[J] = FALSE;
-            }
+      for (I = 0; I < N; I++) SA[I] = -1;
+      for (I = 1; I < N; I++) if (IS_LMS(I)) SA[--Bucket[SYMBOL(I)]] = I;
+
+      InduceL(T,SA,Bucket,Type,N,K,Cs);
+      InduceS(T,SA,Bucket,Type,N,K,Cs);
+
+      for (I = 0, N1 = 0; I < N; I++) if (IS_LMS(SA[I])) SA[N1++] = SA[I];
+
+      if (Bucket != &SA[N]) free(Bucket);
+   }
+
+   /* Name them in sorted order, equal substrings share a name; names */
+   /* go to SA[N1+P/2] (LMS positions are 2 apart), then to the end   */
+
+   for (I = N1; I < N; I++) SA[I] = -1;
+
+   Name = 0;
+   Q    = -1;
+
+   for (I = 0; I < N1; I++) {
+
+      P    = SA[I];
+      Diff = FALSE;
+
+      for (D = 0; TRUE; D++) {
+         if (Q == -1 || P+D == N || Q+D == N || SYMBOL(P+D) != SYMBOL(Q+D) || TYPE_S(P+D) != TYPE_S(Q+D)) {
+            Diff = TRUE;
+            break;
          }
+         if (D > 0 && (IS_LMS(P+D) || IS_LMS(Q+D))) break;
       }
 
-      for (I = 0; I < N; I++) {
-         Pos[Prm[I]] = I;
-         BH[I] = B2H[I];
+      if (Diff) {
+         Name++;
+         Q = P;
       }
+
+      SA[N1+P/2] = Name - 1;
    }
+
+   for (I = N-1, J = N-1; I >= N1; I--) if (SA[I] >= 0) SA[J--] = SA[I];
+
+   /* Sort the reduced string of names, directly if they're all distinct */
+
+   S1 = &SA[N-N1];
+
+   if (Name < N1) {
+      SortSuffixIS(S1,SA,N-2*N1,N1,Name,sizeof(int),1);
+   } else {
+      for (I = 0; I < N1; I++) SA[S1[I]] = I;
+   }
+
+   if (K <= Fs) {
+      Bucket = &SA[N];
+   } else {
+      Bucket = malloc(K*sizeof(int));
+      if (Bucket == NULL) FatalError("SortSuffixIS(): Not enough memory");
+   }
+
+   /* Sorted LMS suffixes at their bucket ends, in order, then induce */
+
+   GetBuckets(T,Bucket,N,K,Cs,TRUE);
+
+   for (I = 1, J = 0; I < N; I++) if (IS_LMS(I)) S1[J++] = I;
+   for (I = 0; I < N1; I++) SA[I] = S1[SA[I]];
+   for (I = N1; I < N; I++) SA[I] = -1;
+
+   for (I = N1-1; I >= 0; I--) {
+      J     = SA[I];
+      SA[I] = -1;
+      SA[--Bucket[SYMBOL(J)]] = J;
+   }
+
+   InduceL(T,SA,Bucket,Type,N,K,Cs);
+   InduceS(T,SA,Bucket,Type,N,K,Cs);
+
+   if (Bucket != &SA[N]) free(Bucket);
+   free(Type);
 }
 
-/* CompLast() */
+/* SortLMS() */
+
+static int SortLMS(const uchar *T, int *SA, const uchar *Type, int N, int ThreadNb) {
+
+   int I, K, N1, Next, *Start;
+   semaphore Lock[1];
+   sorter *Sorter;
+
+   /* LMS positions by their first two bytes (the second exists, N-1 is */
+   /* L-type), then each bucket sorted by a thread; threads take the    */
+   /* next unsorted bucket when done. Merge space is SA[N1..2*N1)       */
+
+   Start = malloc((PAIR_NB+1)*sizeof(int));
+   if (Start == NULL) FatalError("SortLMS(): Not enough memory");
+
+   for (K = 0; K <= PAIR_NB; K++) Start[K] = 0;
+   for (I = 1; I < N; I++) if (IS_LMS(I)) Start[T[I]<<8|T[I+1]]++;
+
+   for (K = 0, N1 = 0; K < PAIR_NB; K++) {
+      I = Start[K];
+      Start[K] = N1;
+      N1 += I;
+   }
+
+   for (I = 1; I < N; I++) if (IS_LMS(I)) SA[Start[T[I]<<8|T[I+1]]++] = I;
+
+   for (K = PAIR_NB; K > 0; K--) Start[K] = Start[K-1];
+   Start[0] = 0;
+
+   Next = 0;
+   InitSemaphore(Lock,1);
+
+   Sorter = Nalloc(ThreadNb*sizeof(sorter),"BWT sorters");
+
+   for (I = 0; I < ThreadNb; I++) {
+      Sorter[I].T     = T;
+      Sorter[I].Type  = Type;
+      Sorter[I].N     = N;
+      Sorter[I].SA    = SA;
+      Sorter[I].Temp  = &SA[N1];
+      Sorter[I].Start = Start;
+      Sorter[I].Lock  = Lock;
+      Sorter[I].Next  = &Next;
+      StartThread(Sorter[I].Thread,&WorkLMS,&Sorter[I]);
+   }
+
+   for (I = 0; I < ThreadNb; I++) JoinThread(Sorter[I].Thread);
+
+   Free(Sorter);
+   FreeSemaphore(Lock);
+   free(Start);
+
+   return N1;
+}
 
-static void CompLast(void) {
+/* WorkLMS() */
+
+static void WorkLMS(void *Data) {
+
+   int K;
+   const int *Start;
+   sorter *Sorter;
+
+   Sorter = Data;
+   Start  = Sorter->Start;
+
+   while (TRUE) {
+
+      WaitSemaphore(Sorter->Lock);
+      for (K = *Sorter->Next; K < PAIR_NB && Start[K+1] - Start[K] < 2; K++)
+         ;
+      *Sorter->Next = K + 1;
+      PostSemaphore(Sorter->Lock);
+
+      if (K >= PAIR_NB) break;
+
+      MergeLMS(Sorter,&Sorter->SA[Start[K]],&Sorter->Temp[Start[K]],Start[K+1]-Start[K]);
+   }
+}
+
+/* MergeLMS() */
+
+static void MergeLMS(const sorter *Sorter, int *A, int *Temp, int Size) {
+
+   int I, J, K, Half, P;
+
+   if (Size < MERGE_MIN) {
+      for (I = 1; I < Size; I++) {
+         P = A[I];
+         for (J = I; J > 0 && CompareLMS(Sorter->T,Sorter->Type,Sorter->N,A[J-1],P) > 0; J--) A[J] = A[J-1];
+         A[J] = P;
+      }
+      return;
+   }
+
+   Half = Size / 2;
+
+   MergeLMS(Sorter,A,Temp,Half);
+   MergeLMS(Sorter,&A[Half],&Temp[Half],Size-Half);
+
+   if (CompareLMS(Sorter->T,Sorter->Type,Sorter->N,A[Half-1],A[Half]) <= 0) return;
+
+   for (I = 0, J = Half, K = 0; I < Half && J < Size; K++) {
+      if (CompareLMS(Sorter->T,Sorter->Type,Sorter->N,A[I],A[J]) <= 0) {
+         Temp[K] = A[I++];
+      } else {
+         Temp[K] = A[J++];
+      }
+   }
+   while (I < Half) Temp[K++] = A[I++];
+   while (J < Size) Temp[K++] = A[J++];
+
+   memcpy(A,Temp,Size*sizeof(int));
+}
+
+/* CompareLMS() */
+
+static int CompareLMS(const uchar *T, const uchar *Type, int N, int P, int Q) {
+
+   int D;
+
+   /* LMS substring order: symbol, then type (L before S), up to the */
+   /* next LMS position; the sentinel comes first                     */
+
+   for (D = 0; TRUE; D++) {
+      if (P+D == N) return -1;
+      if (Q+D == N) return +1;
+      if (T[P+D] != T[Q+D]) return (int) T[P+D] - (int) T[Q+D];
+      if (TYPE_S(P+D) != TYPE_S(Q+D)) return (int) TYPE_S(P+D) - (int) TYPE_S(Q+D);
+      if (D > 0 && IS_LMS(P+D)) return 0;
+   }
+}
+
+/* GetBuckets() */
+
+static void GetBuckets(const void *T, int *Bucket, int N, int K, int Cs, int End) {
+
+   int I, Sum;
+
+   for (I = 0; I < K; I++) Bucket[I] = 0;
+   for (I = 0; I < N; I++) Bucket[SYMBOL(I)]++;
+
+   for (I = 0, Sum = 0; I < K; I++) {
+      Sum += Bucket[I];
+      Bucket[I] = (End) ? Sum : Sum - Bucket[I];
+   }
+}
+
+/* InduceL() */
+
+static void InduceL(const void *T, int *SA, int *Bucket, const uchar *Type, int N, int K, int Cs) {
 
    int I, J;
 
+   /* L-type suffixes, left to right from their bucket starts; N-1 comes */
+   /* first, induced by the sentinel                                    */
+
+   GetBuckets(T,Bucket,N,K,Cs,FALSE);
+
+   SA[Bucket[SYMBOL(N-1)]++] = N - 1;
+
    for (I = 0; I < N; I++) {
-      if (Pos[I] == 0) Index = I;
-      J = Pos[I] - 1;
-      if (J < 0) J += N;
-      L[I] = S[J];
+      J = SA[I] - 1;
+      if (J >= 0 && ! TYPE_S(J)) SA[Bucket[SYMBOL(J)]++] = J;
    }
 }
 
-/* CompFirst() */
+/* InduceS() */
 
-static void CompFirst(void) {
+static void InduceS(const void *T, int *SA, int *Bucket, const uchar *Type, int N, int K, int Cs) {
 
-   int I, Char, Sum, SumOld;
+   int I, J;
 
-   for (Char = 0; Char < 256; Char++) C[Char] = 0;
+   /* S-type suffixes, right to left from their bucket ends */
+
+   GetBuckets(T,Bucket,N,K,Cs,TRUE);
+
+   for (I = N-1; I >= 0; I--) {
+      J = SA[I] - 1;
+      if (J >= 0 && TYPE_S(J)) SA[--Bucket[SYMBOL(J)]] = J;
+   }
+}
+
+/* CompLast() */
+
+static void CompLast(bwt *Bwt) {
+
+   int I, J, N, Len;
+
+   N   = Bwt->N;
+   Len = (N + Bwt->Chains - 1) / Bwt->Chains;
+
+   /* Chain J decodes the text from (J+1)*Len down, see CompBlock() */
 
    for (I = 0; I < N; I++) {
-      Char = L[I];
-      P[I] = C[Char];
-      C[Char]++;
+      if (Bwt->Pos[I] == 0) {
+         Bwt->Index = I;
+      } else if (Bwt->Pos[I] % Len == 0) {
+         Bwt->Start[Bwt->Pos[I]/Len-1] = I;
+      }
+      J = Bwt->Pos[I] - 1;
+      if (J < 0) J += N;
+      Bwt->L[I] = Bwt->S[J];
    }
+}
+
+/* CompFirst() */
+
+static void CompFirst(bwt *Bwt) {
+
+   int I, N, Char, Sum, SumOld;
+   int *C;
+   uint *P;
+   const uchar *L;
+
+   N = Bwt->N;
+   L = Bwt->L;
+   C = Bwt->C;
+   P = Bwt->P;
+
+   for (Char = 0; Char < 256; Char++) C[Char] = 0;
+   for (I = 0; I < N; I++) C[L[I]]++;
 
    Sum = 0;
    for (Char = 0; Char < 256; Char++) {
@@ -280,19 +840,77 @@ static void CompFirst(void) {
       Sum += C[Char];
       C[Char] = SumOld;
    }
+
+   /* P[I] = LF(I), the row of the rotation one byte to the left; the */
+   /* byte shares its word when the row fits in 24 bits, so that each  */
+   /* step of the chain is a single random access                      */
+
+   if (N <= PACK_MAX) {
+      for (I = 0; I < N; I++) {
+         Char = L[I];
+         P[I] = ((uint) C[Char]++ << 8) | Char;
+      }
+      FreeLast(Bwt);
+   } else {
+      for (I = 0; I < N; I++) P[I] = (uint) C[L[I]]++;
+   }
 }
 
 /* CompBlock() */
 
-static void CompBlock(void) {
+static void CompBlock(bwt *Bwt) {
+
+   int I, J, K, N, Len, Full;
+   uint W, Row[CHAINS];
+   const uint *P;
+   const uchar *L;
+   uchar *S;
+
+   S = Bwt->S;
+   N = Bwt->N;
+   L = Bwt->L;
+   P = Bwt->P;
 
-   int I, J, Char;
+   if (N == 0) return;
 
-   I = Index;
-   for (J = N-1; J >= 0; J--) {
-      Char = L[I];
-      S[J] = L[I];
-      I = C[Char] + P[I];
+   /* Chain J goes back from row Start[J] (Index for the text end) over */
+   /* Len bytes; the Full whole chains are followed in lockstep so that */
+   /* their cache misses overlap, the short last one on its own         */
+
+   Len  = (N + Bwt->Chains - 1) / Bwt->Chains;
+   Full = N / Len;
+
+   for (J = 0; J < Full; J++) Row[J] = ((J+1) * Len < N) ? Bwt->Start[J] : Bwt->Index;
+
+   if (L == NULL) {
+
+      for (K = Len-1; K >= 0; K--) {
+         for (J = 0; J < Full; J++) {
+            W = P[Row[J]];
+            S[J*Len+K] = (uchar) W;
+            Row[J] = W >> 8;
+         }
+      }
+
+      for (I = Bwt->Index, K = N-1; K >= Full*Len; K--) {
+         W = P[I];
+         S[K] = (uchar) W;
+         I = W >> 8;
+      }
+
+   } else {
+
+      for (K = Len-1; K >= 0; K--) {
+         for (J = 0; J < Full; J++) {
+            S[J*Len+K] = L[Row[J]];
+            Row[J] = P[Row[J]];
+         }
+      }
+
+      for (I = Bwt->Index, K = N-1; K >= Full*Len; K--) {
+         S[K] = L[I];
+         I = P[I];
+      }
    }
 }
 
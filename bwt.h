@@ -5,20 +5,18 @@
 #define BWT_H
 
 #include "types.h"
+#include "algo.h"
 
 /* Constants */
 
 #define SIZE 2097152
 
-/* Variables */
-
-extern int    Index;
-extern uchar *L;
+#define CHUNK_SIZE 16777216 /* Largest block sorted at once, bigger ones are cut (version 4 framing) */
 
 /* Prototypes */
 
-extern void CodeBWT   (void);
-extern void DecodeBWT (void);
+extern void CodeBWT   (codec *Codec);
+extern void DecodeBWT (codec *Codec);
 
 #endif /* ! defined BWT_H */
 
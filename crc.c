@@ -15,12 +15,19 @@
 
 uint CRC(const void *Block, int Size) { /* Adler32 */
 
+   return UpdateCRC(CRC_INIT,Block,Size);
+}
+
+/* UpdateCRC() */
+
+uint UpdateCRC(uint Crc, const void *Block, int Size) { /* Crc of the data before Block */
+
    uint S1, S2;
    int N1, N2;
    const uchar *Buffer;
 
-   S1 = 1;
-   S2 = 0;
+   S1 = Crc & 0xFFFF;
+   S2 = Crc >> 16;
 
    Buffer = Block;
 
@@ -6,9 +6,14 @@
 
 #include "types.h"
 
+/* Constants */
+
+#define CRC_INIT 1 /* CRC of no data */
+
 /* Prototypes */
 
-extern uint CRC (const void *Block, int Size);
+extern uint CRC       (const void *Block, int Size);
+extern uint UpdateCRC (uint Crc, const void *Block, int Size);
 
 #endif /* ! defined CRC_H */
 
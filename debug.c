@@ -39,6 +39,19 @@ void *Nalloc(int Size, const char *Name) {
    return Malloc(Size);
 }
 
+/* Realloc() */
+
+void *Realloc(void *Address, int Size) {
+
+   assert(Address!=NULL);
+   assert(Size>0);
+
+   Address = realloc(Address,Size);
+   if (Address == NULL) FatalError("Realloc(%d): realloc() = NULL",Size);
+
+   return Address;
+}
+
 /* Free() */
 
 void Free(void *Address) {
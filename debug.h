@@ -24,6 +24,7 @@ extern void  FatalError (const char *Message, ...);
 
 extern void *Malloc     (int Size);
 extern void *Nalloc     (int Size, const char *Name);
+extern void *Realloc    (void *Address, int Size);
 extern void  Free       (void *Address);
 
 #endif /* ! defined DEBUG_H */
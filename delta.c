@@ -7,10 +7,6 @@
 #include "types.h"
 #include "algo.h"
 
-/* Variables */
-
-static uint Count[256];
-
 /* Functions */
 
 /* BestDelta() */
@@ -18,6 +14,7 @@ static uint Count[256];
 int BestDelta(const void *Block, int Size) {
 
    int I, C, Delta;
+   uint Count[256];
    const uchar *Buffer;
 
    Buffer = Block;
@@ -34,7 +31,7 @@ int BestDelta(const void *Block, int Size) {
 
 /* CodeDelta() */
 
-void CodeDelta(void *Block, int Size) {
+void CodeDelta(void *Block, int Size, int Delta) {
 
    int I;
    uchar *Buffer;
@@ -61,7 +58,7 @@ void CodeDelta(void *Block, int Size) {
 
 /* DecodeDelta() */
 
-void DecodeDelta(void *Block, int Size) {
+void DecodeDelta(void *Block, int Size, int Delta) {
 
    int I;
    uchar *Buffer;
@@ -15,8 +15,8 @@
 
 extern int  BestDelta   (const void *Block, int Size);
 
-extern void CodeDelta   (void *Block, int Size);
-extern void DecodeDelta (void *Block, int Size);
+extern void CodeDelta   (void *Block, int Size, int Delta);
+extern void DecodeDelta (void *Block, int Size, int Delta);
 
 #endif /* ! defined DELTA_H */
 
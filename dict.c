@@ -0,0 +1,284 @@
+
+/* Dict.C */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "types.h"
+#include "algo.h"
+#include "bitio.h"
+#include "debug.h"
+
+/* Constants */
+
+#define DMER_SIZE   8   /* Bytes hashed together when scoring */
+#define DMER_BIT    20
+#define SEGMENT     128 /* Dictionary pieces, one per epoch at most */
+
+/* Types */
+
+typedef struct {
+   int Start;
+   int Score;
+} segment;
+
+typedef struct {
+   const uchar *S;       /* Samples, back to back */
+   int          N;
+   int         *End;     /* End of the sample at each position */
+   int         *Freq;    /* Samples containing each dmer, 0 once covered */
+   int         *Count;   /* Dmer occurrences in the current window */
+   int          Score;   /* Window score */
+} trainer;
+
+/* Prototypes */
+
+static int  DmerKey  (const uchar *S);
+
+static void AddDmer  (trainer *Trainer, int P);
+static void RemDmer  (trainer *Trainer, int P);
+
+static int  SegmentCmp (const void *S1, const void *S2);
+
+/* Functions */
+
+/* TrainDict() */
+
+int TrainDict(uchar Dict[], int Size, const uchar *Sample[], const int SampleSize[], int SampleNb) {
+
+   int I, J, P, Key, N, EpochNb, EpochSize, Epoch, Start, End, Last, Best, BestScore, SegmentNb, DictSize;
+   int *Seen;
+   uchar *S;
+   segment *Segment;
+   trainer Trainer[1];
+
+   N = 0;
+   for (I = 0; I < SampleNb; I++) N += SampleSize[I];
+
+   S = Nalloc(N+1,"Dictionary samples");
+   Trainer->S   = S;
+   Trainer->N   = N;
+   Trainer->End = Nalloc((N+1)*sizeof(int),"Dictionary sample ends");
+
+   for (I = 0, P = 0; I < SampleNb; I++) {
+      memcpy(&S[P],Sample[I],(size_t)SampleSize[I]);
+      for (J = 0; J < SampleSize[I]; J++) Trainer->End[P+J] = P + SampleSize[I];
+      P += SampleSize[I];
+   }
+
+   /* Few samples => they all fit, most recent last */
+
+   if (N <= Size) {
+      memcpy(Dict,S,(size_t)N);
+      Free(Trainer->End);
+      Free(S);
+      return N;
+   }
+
+   /* Dmer scores are the number of samples they appear in; a dmer seen in */
+   /* one sample only can't help any other file                           */
+
+   Trainer->Freq  = Nalloc((1<<DMER_BIT)*sizeof(int),"Dictionary dmers");
+   Trainer->Count = Nalloc((1<<DMER_BIT)*sizeof(int),"Dictionary dmers");
+   Seen           = Nalloc((1<<DMER_BIT)*sizeof(int),"Dictionary dmers");
+
+   for (I = 0; I < 1 << DMER_BIT; I++) {
+      Trainer->Freq[I]  = 0;
+      Trainer->Count[I] = 0;
+      Seen[I]           = -1;
+   }
+
+   Trainer->Score = 0;
+
+   for (I = 0, P = 0; I < SampleNb; P += SampleSize[I], I++) {
+      for (J = P; J + DMER_SIZE <= P + SampleSize[I]; J++) {
+         Key = DmerKey(&S[J]);
+         if (Seen[Key] != I) {
+            Seen[Key] = I;
+            Trainer->Freq[Key]++;
+         }
+      }
+   }
+
+   for (I = 0; I < 1 << DMER_BIT; I++) {
+      if (Trainer->Freq[I] < 2) Trainer->Freq[I] = 0;
+   }
+
+   Free(Seen);
+
+   /* Cover: the samples are cut into epochs, and the best-scoring segment */
+   /* of each one is kept. Dmers it contains then score 0, so later picks  */
+   /* bring something new.                                                 */
+
+   EpochNb   = Size / SEGMENT;
+   EpochSize = N / EpochNb;
+   if (EpochSize < SEGMENT) EpochSize = SEGMENT;
+
+   Segment   = Nalloc((EpochNb+1)*sizeof(segment),"Dictionary segments");
+   SegmentNb = 0;
+
+   for (Epoch = 0; Epoch * EpochSize < N && SegmentNb < EpochNb; Epoch++) {
+
+      Start = Epoch * EpochSize;
+      End   = Start + EpochSize;
+      if (End > N) End = N;
+
+      Best      = -1;
+      BestScore = 0;
+
+      /* Slide a SEGMENT-byte window over each sample of the epoch */
+
+      for (P = Start; P < End; P = Trainer->End[P]) {
+
+         Last = Trainer->End[P] - SEGMENT + 1; /* Past the last window */
+         if (Last > End) Last = End;
+         if (Last <= P) continue;
+
+         for (I = P; I <= P + SEGMENT - DMER_SIZE; I++) AddDmer(Trainer,I);
+
+         for (J = P; ; J++) {
+
+            if (Trainer->Score > BestScore) {
+               BestScore = Trainer->Score;
+               Best      = J;
+            }
+
+            if (J + 1 >= Last) break;
+
+            RemDmer(Trainer,J);
+            AddDmer(Trainer,J+SEGMENT-DMER_SIZE+1);
+         }
+
+         for (I = J; I <= J + SEGMENT - DMER_SIZE; I++) RemDmer(Trainer,I);
+      }
+
+      if (Best >= 0) {
+         Segment[SegmentNb].Start = Best;
+         Segment[SegmentNb].Score = BestScore;
+         SegmentNb++;
+         for (I = Best; I <= Best + SEGMENT - DMER_SIZE; I++) Trainer->Freq[DmerKey(&S[I])] = 0;
+      }
+   }
+
+   /* Best segments last, closest to the data */
+
+   qsort(Segment,(size_t)SegmentNb,sizeof(segment),&SegmentCmp);
+
+   DictSize = SegmentNb * SEGMENT;
+
+   for (I = 0; I < SegmentNb; I++) memcpy(&Dict[I*SEGMENT],&S[Segment[I].Start],SEGMENT);
+
+   Free(Segment);
+   Free(Trainer->Count);
+   Free(Trainer->Freq);
+   Free(Trainer->End);
+   Free(S);
+
+   return DictSize;
+}
+
+/* LoadDict() */
+
+void LoadDict(codec *Codec, const char *FileName) {
+
+   int Size;
+
+   Codec->Dict = LoadFile(FileName,&Size);
+   if (Codec->Dict == NULL) FatalError("Couldn't open dictionary \"%s\"",FileName);
+   if (Size > DICT_SIZE_MAX) FatalError("Dictionary \"%s\" is too large (%d > %d bytes)",FileName,Size,DICT_SIZE_MAX);
+
+   Codec->DictSize = Size;
+}
+
+/* FreeDict() */
+
+void FreeDict(codec *Codec) {
+
+   if (Codec->Dict != NULL) {
+      Free(Codec->Dict);
+      Codec->Dict = NULL;
+   }
+
+   Codec->DictSize = 0;
+}
+
+/* LoadFile() */
+
+uchar *LoadFile(const char *FileName, int *Size) {
+
+   int Max, Done;
+   uchar *Buffer;
+   stream Stream[1];
+
+   /* Whole file in an owned buffer, NULL if it can't be opened */
+
+   if (! OpenMapStream(Stream,FileName)) return NULL;
+
+   *Size  = 0;
+   Max    = STREAM_BUFFER_SIZE;
+   Buffer = Nalloc(Max,FileName);
+
+   while ((Done = GetBlock(Stream,Buffer+*Size,Max-*Size)) > 0) {
+      *Size += Done;
+      if (*Size == Max) {
+         if (Max > DICT_SIZE_MAX) break; /* Enough to tell it's too large */
+         Max   *= 2;
+         Buffer = Realloc(Buffer,Max);
+      }
+   }
+
+   CloseStream(Stream);
+
+   return Buffer;
+}
+
+/* DmerKey() */
+
+static int DmerKey(const uchar *S) {
+
+   uint Low, High;
+
+   Low  = (uint) S[0] | ((uint) S[1] << 8) | ((uint) S[2] << 16) | ((uint) S[3] << 24);
+   High = (uint) S[4] | ((uint) S[5] << 8) | ((uint) S[6] << 16) | ((uint) S[7] << 24);
+
+   return (int) ((((Low * 2654435761U) ^ (High * 2246822519U)) & 0xFFFFFFFFU) >> (32 - DMER_BIT));
+}
+
+/* AddDmer() */
+
+static void AddDmer(trainer *Trainer, int P) {
+
+   int Key;
+
+   Key = DmerKey(&Trainer->S[P]);
+   if (Trainer->Count[Key]++ == 0) Trainer->Score += Trainer->Freq[Key];
+}
+
+/* RemDmer() */
+
+static void RemDmer(trainer *Trainer, int P) {
+
+   int Key;
+
+   Key = DmerKey(&Trainer->S[P]);
+   if (--Trainer->Count[Key] == 0) Trainer->Score -= Trainer->Freq[Key];
+}
+
+/* SegmentCmp() */
+
+static int SegmentCmp(const void *S1, const void *S2) {
+
+   const segment *Segment1, *Segment2;
+
+   Segment1 = S1;
+   Segment2 = S2;
+
+   if (Segment1->Score != Segment2->Score) return (Segment1->Score < Segment2->Score) ? -1 : +1;
+
+   return Segment1->Start - Segment2->Start;
+}
+
+/* End of Dict.C */
+
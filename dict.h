@@ -0,0 +1,27 @@
+
+/* Dict.H */
+
+#ifndef DICT_H
+#define DICT_H
+
+#include "types.h"
+#include "algo.h"
+
+/* Constants */
+
+#define DICT_SIZE_MAX     1048576 /* Larger dictionary files are refused */
+#define DICT_SIZE_DEFAULT 32768   /* Trained dictionaries, half the lzh window */
+
+/* Prototypes */
+
+extern int  TrainDict (uchar Dict[], int Size, const uchar *Sample[], const int SampleSize[], int SampleNb);
+
+extern void LoadDict  (codec *Codec, const char *FileName);
+extern void FreeDict  (codec *Codec);
+
+extern uchar *LoadFile (const char *FileName, int *Size);
+
+#endif /* ! defined DICT_H */
+
+/* End of Dict.H */
+
@@ -12,6 +12,7 @@
 #include "debug.h"
 #include "huffman.h"
 #include "mtf.h"
+#include "split.h"
 
 /* Constants */
 
@@ -20,78 +21,62 @@
 #define FORMAT         DELTA
 
 #define BLOCK_SIZE_MIN 256
-#define BLOCK_SIZE_MAX 65536
-#define BLOCK_SIZE_BIT 16
+#define BLOCK_SIZE_BIT SPLIT_SIZE_BIT
 
 #define TABLE_NB       256
 #define TABLE_NB_MAX   256
 #define TABLE_BIT      3
 
-/* Types */
-
-typedef struct block_node block_node;
-
-struct block_node {
-   block_node *Succ;
-   block_node *Pred;
-   int         Start;
-   int         End;
-   int         Size;
-   int         Len;
-   int         MergeLen;
-   int         Freq[SYMBOL_NB];
-};
-
-typedef struct {
-   block_node *Head;
-   block_node *Tail;
-} block_list;
-
-/* Variables */
-
-ushort *HufBlock;
-int     HufBlockSize;
-
-static block_list BlockList[1];
-static int        BlockNb;
-static int        BlockLen;
-
 /* Functions */
 
 /* AllocHufBlock() */
 
-void AllocHufBlock(void) {
+void AllocHufBlock(hufblock *HufBlock, int Size) {
 
-   HufBlock = malloc((size_t)(N*sizeof(int)));
-   if (HufBlock == NULL) FatalError("AllocHufBlock(): malloc() = NULL");
+   HufBlock->Sym = malloc((size_t)(Size*sizeof(int)));
+   if (HufBlock->Sym == NULL) FatalError("AllocHufBlock(): malloc() = NULL");
 
-   HufBlockSize = 0;
+   HufBlock->Size = 0;
 }
 
 /* FreeHufBlock() */
 
-void FreeHufBlock(void) {
+void FreeHufBlock(hufblock *HufBlock) {
 
-   if (HufBlock != NULL) {
-      free(HufBlock);
-      HufBlock = NULL;
+   if (HufBlock->Sym != NULL) {
+      free(HufBlock->Sym);
+      HufBlock->Sym = NULL;
    }
 }
 
 /* GetHufBlock() */
 
-void GetHufBlock(void) {
+void GetHufBlock(codec *Codec, hufblock *HufBlock) {
 
-   int I, J, Size, BlockSize, TableBit, TableNb;
+   int I, J, Size, BlockSize, BlockNb, TableBit, TableNb;
    uchar TableNo[TABLE_NB];
    huftable HufTable[1], Table[TABLE_NB][1];
+   stream *In;
+
+   In = Codec->In;
+
+   if (Codec->Version == 0) {
+
+      HufBlock->Size = GetBits(In,25) + 1;
+      BlockSize      = GetBits(In,BLOCK_SIZE_BIT) + 1;
+      BlockNb        = (HufBlock->Size + BlockSize - 1) / BlockSize;
 
-   HufBlockSize = GetBits(25) + 1;
-   BlockSize    = GetBits(BLOCK_SIZE_BIT) + 1;
-   BlockNb      = (HufBlockSize + BlockSize - 1) / BlockSize;
+      TableBit = GetBits(In,TABLE_BIT) + 1;
+      TableNb  = GetBits(In,TableBit) + 1;
 
-   TableBit = GetBits(TABLE_BIT) + 1;
-   TableNb  = GetBits(TableBit) + 1;
+   } else { /* No header, blocks only */
+
+      BlockSize = 0;
+      BlockNb   = 0;
+
+      TableBit = 2;
+      TableNb  = 1;
+   }
 
    if (TableBit == 2 && TableNb == 1) { /* Fake header => blocks */
 
@@ -99,40 +84,40 @@ void GetHufBlock(void) {
 
       AllocHufTable(HufTable,SYMBOL_NB,LEN_MAX,FORMAT);
 
-      while (GetBit() == 1) {
+      while (GetBit(In) == 1) {
 
-         BlockSize = GetBits(BLOCK_SIZE_BIT) + 1;
+         BlockSize = GetBits(In,BLOCK_SIZE_BIT) + 1;
 
-         GetLens(HufTable);
+         GetLens(In,HufTable);
 
          CompCodes(HufTable);
          CompDecodeTable(HufTable);
 
-         do HufBlock[Size++] = GetHufSym(HufTable); while (--BlockSize != 0);
+         do HufBlock->Sym[Size++] = GetHufSym(In,HufTable); while (--BlockSize != 0);
       }
 
       FreeHufTable(HufTable);
 
-      HufBlockSize = Size;
+      HufBlock->Size = Size;
 
    } else {
 
-      if (Verbosity >= 2) {
-         fprintf(stderr,"FullBlockSize = %d\n",HufBlockSize);
+      if (Codec->Verbosity >= 2) {
+         fprintf(stderr,"FullBlockSize = %d\n",HufBlock->Size);
          fprintf(stderr,"BlockSize = %d\n",BlockSize);
          fprintf(stderr,"BlockNb = %d\n",BlockNb);
       }
 
-      if (Verbosity >= 2) fprintf(stderr,"TableNb = %d\n",TableNb);
+      if (Codec->Verbosity >= 2) fprintf(stderr,"TableNb = %d\n",TableNb);
 
       for (I = 0; I < TableNb; I++) {
          AllocHufTable(Table[I],SYMBOL_NB,LEN_MAX,FORMAT);
-         GetLens(Table[I]);
+         GetLens(In,Table[I]);
       }
 
       for (I = 0; I < BlockNb; I++) {
          TableNo[I] = 0;
-         while (GetBit() == 1) TableNo[I]++;
+         while (GetBit(In) == 1) TableNo[I]++;
       }
 
       DecodeMTF(TableNo,BlockNb);
@@ -142,8 +127,8 @@ void GetHufBlock(void) {
       for (I = 0; I < BlockNb; I++) {
          CompCodes(Table[TableNo[I]]);
          CompDecodeTable(Table[TableNo[I]]);
-         for (J = 0; J < BlockSize && Size < HufBlockSize; J++) {
-            HufBlock[Size++] = GetHufSym(Table[TableNo[I]]);
+         for (J = 0; J < BlockSize && Size < HufBlock->Size; J++) {
+            HufBlock->Sym[Size++] = GetHufSym(In,Table[TableNo[I]]);
          }
       }
 
@@ -153,136 +138,54 @@ void GetHufBlock(void) {
 
 /* SendHufBlock() */
 
-void SendHufBlock(void) {
+void SendHufBlock(codec *Codec, const hufblock *HufBlock) {
 
-   int I, Start, Gain, BestGain, Freq[SYMBOL_NB];
-   block_node *Block, *BestBlock;
+   int I, B, HufBlockSize;
+   split_block *Block;
+   split Split[1];
    huftable HufTable[1];
+   stream *Out;
+
+   Out          = Codec->Out;
+   HufBlockSize = HufBlock->Size;
 
    if (HufBlockSize <= 0) FatalError("HufBlockSize (%d) <= 0 in SendHufBlock()",HufBlockSize);
 
    AllocHufTable(HufTable,SYMBOL_NB,LEN_MAX,FORMAT);
 
-   BlockList->Head = NULL;
-   BlockList->Tail = NULL;
-   
-   BlockNb  = 0;
-   BlockLen = 0;
-
-   for (Start = 0; Start < HufBlockSize; Start += BLOCK_SIZE_MIN) {
-      
-      Block = Nalloc(sizeof(block_node),"BWT block node");
-      
-      Block->Start = Start;
-      Block->End = Block->Start + BLOCK_SIZE_MIN;
-      if (Block->End > HufBlockSize) Block->End = HufBlockSize;
-      Block->Size = Block->End - Block->Start;
-
-      for (I = 0; I < SYMBOL_NB; I++)             Block->Freq[I] = 0;
-      for (I = Block->Start; I < Block->End; I++) Block->Freq[HufBlock[I]]++;
-
-      CompLens(HufTable,Block->Freq);
-      Block->Len = PredictLen(HufTable);
-
-      Block->Pred = BlockList->Tail;
-      Block->Succ = NULL;
-
-      if (BlockList->Tail != NULL) {
-         BlockList->Tail->Succ = Block;
-      } else {
-         BlockList->Head = Block;
-      }
-      BlockList->Tail = Block;
-
-      BlockNb++;
-      BlockLen += Block->Len;
-   }
-
-   for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
-      if (Block->Succ != NULL) {
-         for (I = 0; I < SYMBOL_NB; I++) Freq[I] = Block->Freq[I] + Block->Succ->Freq[I];
-         CompLens(HufTable,Freq);
-         Block->MergeLen = PredictLen(HufTable);
-      }
-   }
+   SplitBlocks(Split,HufTable,HufBlock->Sym,HufBlockSize,BLOCK_SIZE_MIN,Codec->Group,Codec->Verbosity);
 
-   if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",BlockNb,(double)(HufBlockSize)/(double)BlockNb,(double)BlockLen/8.0);
-
-   if (Group) {
-
-      while (TRUE) {
-
-         BestBlock = NULL;
-         BestGain  = -1;
-
-         for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
-            if (Block->Succ != NULL && Block->Size + Block->Succ->Size <= BLOCK_SIZE_MAX) {
-               Gain = Block->Len + Block->Succ->Len - Block->MergeLen + BLOCK_SIZE_BIT + 1;
-               if (Gain > BestGain) {
-                  BestGain  = Gain;
-                  BestBlock = Block;
-               }
-            }
-         }
-
-         if (BestGain < 0) break;
-
-         BlockNb--;
-         BlockLen -= BestGain;
-
-         if (Verbosity >= 3) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f, Gain = %7.2f\n",BlockNb,(double)(HufBlockSize)/(double)BlockNb,(double)BlockLen/8.0,(double)BestGain/8.0);
-
-         BestBlock->End   = BestBlock->Succ->End;
-         BestBlock->Size += BestBlock->Succ->Size;
-         BestBlock->Len   = BestBlock->MergeLen;
-
-         for (I = 0; I < SYMBOL_NB; I++) BestBlock->Freq[I] += BestBlock->Succ->Freq[I];
-
-         BestBlock->Succ = BestBlock->Succ->Succ;
-
-         if (BestBlock->Succ != NULL) {
-            BestBlock->Succ->Pred = BestBlock;
-            for (I = 0; I < SYMBOL_NB; I++) Freq[I] = BestBlock->Freq[I] + BestBlock->Succ->Freq[I];
-            CompLens(HufTable,Freq);
-            BestBlock->MergeLen = PredictLen(HufTable);
-         }
+   /* Fake header for compatibility */
 
-         if (BestBlock->Pred != NULL) {
-            for (I = 0; I < SYMBOL_NB; I++) Freq[I] = BestBlock->Pred->Freq[I] + BestBlock->Freq[I];
-            CompLens(HufTable,Freq);
-            BestBlock->Pred->MergeLen = PredictLen(HufTable);
-         }
-      }
+   if (Codec->Version == 0) {
+      SendBits(Out,25,0);
+      SendBits(Out,BLOCK_SIZE_BIT,0);
+      SendBits(Out,TABLE_BIT,2-1); /* 001 */
+      SendBits(Out,2,1-1); /* 00 */
    }
 
-   if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",BlockNb,(double)(HufBlockSize)/(double)BlockNb,(double)BlockLen/8.0);
-
-   /* Fake header for compatibility */
-
-   SendBits(25,0);
-   SendBits(BLOCK_SIZE_BIT,0);
-   SendBits(TABLE_BIT,2-1); /* 001 */
-   SendBits(2,1-1); /* 00 */
+   for (B = Split->Head; B != SPLIT_NONE; B = Block->Succ) {
 
-   for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
+      Block = &Split->Block[B];
 
-      SendBit(1);
+      SendBit(Out,1);
 
-      SendBits(BLOCK_SIZE_BIT,Block->Size-1);
+      SendBits(Out,BLOCK_SIZE_BIT,Block->Size-1);
 
-      CompLens(HufTable,Block->Freq);
-      SendLens(HufTable);
+      CompLens(HufTable,BlockFreq(Split,HufBlock->Sym,B));
+      SendLens(Out,HufTable);
 
       CompCodes(HufTable);
       for (I = Block->Start; I < Block->End; I++) {
-	 SendHufSym(HufTable,HufBlock[I]);
+	 SendHufSym(Out,HufTable,HufBlock->Sym[I]);
       }
    }
 
    CheckFreqs(HufTable);
 
-   SendBit(0);
+   SendBit(Out,0);
 
+   FreeSplit(Split);
    FreeHufTable(HufTable);
 }
 
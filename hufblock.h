@@ -5,19 +5,22 @@
 #define HUFBLOCK_H
 
 #include "types.h"
+#include "algo.h"
 
-/* Variables */
+/* Types */
 
-extern ushort *HufBlock;
-extern int     HufBlockSize;
+typedef struct {
+   ushort *Sym;
+   int     Size;
+} hufblock;
 
 /* Prototypes */
 
-extern void AllocHufBlock (void);
-extern void FreeHufBlock  (void);
+extern void AllocHufBlock (hufblock *HufBlock, int Size);
+extern void FreeHufBlock  (hufblock *HufBlock);
 
-extern void GetHufBlock   (void);
-extern void SendHufBlock  (void);
+extern void GetHufBlock   (codec *Codec, hufblock *HufBlock);
+extern void SendHufBlock  (codec *Codec, const hufblock *HufBlock);
 
 #endif /* ! defined HUFBLOCK_H */
 
@@ -11,18 +11,10 @@
 /* Constants */
 
 #define SYMBOL_MAX 1024
-#define LEN_MAX    25
+#define LEN_MAX    HUF_LEN_MAX
 
 #define ROOT       1
 
-/* Types */
-
-typedef struct {
-   int HufSymNb;
-   int CodeMin;
-   int HufSymIndex;
-} codelen;
-
 /* Macros */
 
 #define MAX(A,B)       (((A) >= (B)) ? (A) : (B))
@@ -34,22 +26,12 @@ typedef struct {
 static int Code2Freq[29] = {  0,  1,  2, 16, 14, 12, 10,  8,  6,  4,  3,  5,  7,  9, 11, 13, 15, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28 };
 static int Freq2Code[29] = {  0,  1,  2, 10,  9, 11,  8, 12,  7, 13,  6, 14,  5, 15,  4, 16,  3, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28 };
 
-/* Variables */
-
-static int     HeapSize;
-static hufsym *Heap[SYMBOL_MAX+1];
-
-static hufsym  Node[SYMBOL_MAX-1]; /* Internal nodes of the huffman tree */
-
-static codelen CodeLen[LEN_MAX+1];
-static int     HufSymArray[SYMBOL_MAX], LenMin, LenMax;
-
 /* Prototypes */
 
 static void SimRleLen  (int RepLen, int Len, int LenFreq[]);
-static void SendRleLen (const huftable *HufTable, int RepLen, int Len);
+static void SendRleLen (stream *Stream, const huftable *HufTable, int RepLen, int Len);
 
-static void UpdateHeap (int Root);
+static void UpdateHeap (hufsym *Heap[], int HeapSize, int Root);
 
 static int  Log2       (int N);
 
@@ -67,6 +49,18 @@ void AllocHufTable(huftable *HufTable, int N, int LenMax, int Format) {
    HufTable->Format = Format;
    HufTable->HufSym = malloc((size_t)(N*sizeof(hufsym)));
    if (HufTable->HufSym == NULL) FatalError("AllocHufTable(): Not enough memory");
+
+   HufTable->Heap = malloc((size_t)((N+2)*sizeof(hufsym *)));
+   if (HufTable->Heap == NULL) FatalError("AllocHufTable(): Not enough memory");
+
+   HufTable->Node = malloc((size_t)((N+1)*sizeof(hufsym)));
+   if (HufTable->Node == NULL) FatalError("AllocHufTable(): Not enough memory");
+
+   HufTable->HufSymArray = malloc((size_t)((N+1)*sizeof(int)));
+   if (HufTable->HufSymArray == NULL) FatalError("AllocHufTable(): Not enough memory");
+
+   HufTable->CodeLenMin = 0;
+   HufTable->CodeLenMax = 0;
 }
 
 /* FreeHufTable() */
@@ -79,14 +73,32 @@ void FreeHufTable(huftable *HufTable) {
       free(HufTable->HufSym);
       HufTable->HufSym = NULL;
    }
+
+   if (HufTable->Heap != NULL) {
+      free(HufTable->Heap);
+      HufTable->Heap = NULL;
+   }
+
+   if (HufTable->Node != NULL) {
+      free(HufTable->Node);
+      HufTable->Node = NULL;
+   }
+
+   if (HufTable->HufSymArray != NULL) {
+      free(HufTable->HufSymArray);
+      HufTable->HufSymArray = NULL;
+   }
 }
 
 /* CompLens() */
 
 void CompLens(huftable *HufTable, const int Freq[]) {
 
-   int Tree;
-   hufsym *S, *S1, *S2;
+   int Tree, HeapSize;
+   hufsym *S, *S1, *S2, **Heap, *Node;
+
+   Heap = HufTable->Heap;
+   Node = HufTable->Node;
 
    HeapSize = 0;
 
@@ -105,12 +117,12 @@ void CompLens(huftable *HufTable, const int Freq[]) {
       Heap[++HeapSize] = S;
    }
 
-   for (Tree = HeapSize>>1; Tree > 0; Tree--) UpdateHeap(Tree);
+   for (Tree = HeapSize>>1; Tree > 0; Tree--) UpdateHeap(Heap,HeapSize,Tree);
 
    for (S = Node; HeapSize >= 2; S++) {
       S1 = Heap[ROOT];
       Heap[ROOT] = Heap[HeapSize--];
-      if (HeapSize >= 2) UpdateHeap(ROOT);
+      if (HeapSize >= 2) UpdateHeap(Heap,HeapSize,ROOT);
       S2 = Heap[ROOT];
       S1->Parent = S;
       S2->Parent = S;
@@ -119,7 +131,7 @@ void CompLens(huftable *HufTable, const int Freq[]) {
       S->Code    = 0;
       S->Parent  = NULL;
       Heap[ROOT] = S;
-      if (HeapSize >= 2) UpdateHeap(ROOT);
+      if (HeapSize >= 2) UpdateHeap(Heap,HeapSize,ROOT);
    }
 
    S--;
@@ -136,8 +148,11 @@ void CompLens(huftable *HufTable, const int Freq[]) {
 
 void CompCodes(huftable *HufTable) {
 
-   int I, CodeMin;
+   int I, CodeMin, LenMin, LenMax;
    hufsym *S;
+   codelen *CodeLen;
+
+   CodeLen = HufTable->CodeLen;
 
    for (I = 0; I <= HufTable->LenMax; I++) {
       CodeLen[I].HufSymNb = 0;
@@ -171,13 +186,21 @@ void CompCodes(huftable *HufTable) {
    }
 
    for (I = LenMin; I <= LenMax; I++) CodeLen[I].CodeMin -= CodeLen[I].HufSymNb;
+
+   HufTable->CodeLenMin = LenMin;
+   HufTable->CodeLenMax = LenMax;
 }
 
 /* CompDecodeTable() */
 
-void CompDecodeTable(const huftable *HufTable) {
+void CompDecodeTable(huftable *HufTable) {
+
+   int I, Index, Len, LenMin, LenMax;
+   codelen *CodeLen;
 
-   int I, Index, Len;
+   CodeLen = HufTable->CodeLen;
+   LenMin  = HufTable->CodeLenMin;
+   LenMax  = HufTable->CodeLenMax;
 
    Index = 0;
    for (I = LenMin; I <= LenMax; I++) {
@@ -188,7 +211,7 @@ void CompDecodeTable(const huftable *HufTable) {
    for (I = 0; I < HufTable->N; I++) {
       Len = HufTable->HufSym[I].Len;
       if (Len != 0) {
-         HufSymArray[CodeLen[Len].HufSymIndex] = I;
+         HufTable->HufSymArray[CodeLen[Len].HufSymIndex] = I;
          CodeLen[Len].HufSymIndex++;
       }
    }
@@ -282,7 +305,7 @@ int PredictLen(const huftable *HufTable) {
 
 /* GetLens() */
 
-void GetLens(huftable *HufTable) {
+void GetLens(stream *Stream, huftable *HufTable) {
 
    int Last, Code, Len, RepLen, HufSymBit, LenBit;
    hufsym *S;
@@ -296,7 +319,7 @@ void GetLens(huftable *HufTable) {
    }
 
    HufSymBit = Log2(HufTable->N-1) + 1;
-   Last = GetBits(HufSymBit);
+   Last = GetBits(Stream,HufSymBit);
 
    switch (HufTable->Format) {
 
@@ -305,7 +328,7 @@ void GetLens(huftable *HufTable) {
       LenBit = Log2(HufTable->LenMax) + 1;
 
       for (S = HufTable->HufSym; S <= &HufTable->HufSym[Last]; S++) {
-         Len = GetBits(LenBit);
+         Len = GetBits(Stream,LenBit);
          S->Len = Len;
       }
 
@@ -314,19 +337,19 @@ void GetLens(huftable *HufTable) {
    case DELTA :
 
       LenBit = Log2(HufTable->LenMax) + 1;
-      Len = GetBits(LenBit);
+      Len = GetBits(Stream,LenBit);
       HufTable->HufSym[0].Len = Len;
 
       for (S = HufTable->HufSym+1; S <= &HufTable->HufSym[Last]; S++) {
-         if (GetBit() == 1) { /* 1 */
+         if (GetBit(Stream) == 1) { /* 1 */
             S->Len = 0;
-         } else if (GetBit() == 1) { /* 01 */
+         } else if (GetBit(Stream) == 1) { /* 01 */
             S->Len = Len;
-         } else if (GetBit() == 0) { /* 000 */
-            do Len--; while (GetBit() == 1);
+         } else if (GetBit(Stream) == 0) { /* 000 */
+            do Len--; while (GetBit(Stream) == 1);
             S->Len = Len;
          } else { /* 001 */
-            do Len++; while (GetBit() == 1);
+            do Len++; while (GetBit(Stream) == 1);
             S->Len = Len;
          }
       }
@@ -337,22 +360,22 @@ void GetLens(huftable *HufTable) {
 
       AllocHufTable(LenTable,LEN_MAX+4,15,STORE);
 
-      GetLens(LenTable);
+      GetLens(Stream,LenTable);
       CompCodes(LenTable);
       CompDecodeTable(LenTable);
 
       Len = -1;
 
       for (S = HufTable->HufSym; S <= &HufTable->HufSym[Last];) {
-         Code = GetHufSym(LenTable);
+         Code = GetHufSym(Stream,LenTable);
          if (Code == 0) { /* REPZ 3-10 */
-            RepLen = GetBits(3) + 3;
+            RepLen = GetBits(Stream,3) + 3;
             while (--RepLen >= 0) (S++)->Len = 0;
          } else if (Code == 1) { /* REPZ 11-138 */
-            RepLen = GetBits(7) + 11;
+            RepLen = GetBits(Stream,7) + 11;
             while (--RepLen >= 0) (S++)->Len = 0;
          } else if (Code == 2) { /* REP 3-6 */
-            RepLen = GetBits(2) + 3;
+            RepLen = GetBits(Stream,2) + 3;
             while (--RepLen >= 0) (S++)->Len = Len;
          } else {
             Len = Code - 3;
@@ -370,7 +393,7 @@ void GetLens(huftable *HufTable) {
 
 /* SendLens() */
 
-void SendLens(const huftable *HufTable) {
+void SendLens(stream *Stream, const huftable *HufTable) {
 
    int Last, Len, LastLen, RepLen, HufSymBit, LenBit, LenFreq[LEN_MAX+4];
    hufsym *S;
@@ -380,7 +403,7 @@ void SendLens(const huftable *HufTable) {
    for (Last = HufTable->N-1; Last > 0 && HufTable->HufSym[Last].Len == 0; Last--)
       ;
 
-   SendBits(HufSymBit,Last);
+   SendBits(Stream,HufSymBit,Last);
 
    switch (HufTable->Format) {
 
@@ -389,7 +412,7 @@ void SendLens(const huftable *HufTable) {
       LenBit = Log2(HufTable->LenMax) + 1;
       for (S = HufTable->HufSym; S <= &HufTable->HufSym[Last]; S++) {
          Len = S->Len;
-         SendBits(LenBit,Len);
+         SendBits(Stream,LenBit,Len);
       }
 
       break;
@@ -398,21 +421,21 @@ void SendLens(const huftable *HufTable) {
 
       LenBit = Log2(HufTable->LenMax) + 1;
       Len = HufTable->HufSym[0].Len;
-      SendBits(LenBit,Len);
+      SendBits(Stream,LenBit,Len);
 
       for (S = HufTable->HufSym+1; S <= &HufTable->HufSym[Last]; S++) {
          if (S->Len == 0) {
-            SendBit(1); /* 1 */
+            SendBit(Stream,1); /* 1 */
          } else if (Len == S->Len) {
-            SendBits(2,1); /* 01 */
+            SendBits(Stream,2,1); /* 01 */
          } else if (Len > S->Len) {
-            SendBits(3,0); /* 000 */
-            while (--Len > S->Len) SendBit(1);
-            SendBit(0);
+            SendBits(Stream,3,0); /* 000 */
+            while (--Len > S->Len) SendBit(Stream,1);
+            SendBit(Stream,0);
          } else {
-            SendBits(3,1); /* 001 */
-            while (++Len < S->Len) SendBit(1);
-            SendBit(0);
+            SendBits(Stream,3,1); /* 001 */
+            while (++Len < S->Len) SendBit(Stream,1);
+            SendBit(Stream,0);
          }
       }
 
@@ -440,7 +463,7 @@ void SendLens(const huftable *HufTable) {
       CompLens(LenTable,LenFreq);
       CompCodes(LenTable);
 
-      SendLens(LenTable);
+      SendLens(Stream,LenTable);
 
       LastLen = -1;
       RepLen  = 0;
@@ -449,12 +472,12 @@ void SendLens(const huftable *HufTable) {
          if (Len == LastLen) {
             RepLen++;
          } else {
-            if (RepLen > 0) SendRleLen(LenTable,RepLen,LastLen);
+            if (RepLen > 0) SendRleLen(Stream,LenTable,RepLen,LastLen);
             LastLen = Len;
             RepLen  = 1;
          }
       }
-      if (RepLen > 0) SendRleLen(LenTable,RepLen,LastLen);
+      if (RepLen > 0) SendRleLen(Stream,LenTable,RepLen,LastLen);
 
       FreeHufTable(LenTable);
 
@@ -495,60 +518,64 @@ static void SimRleLen(int RepLen, int Len, int LenFreq[]) {
 
 /* SendRleLen() */
 
-static void SendRleLen(const huftable *LenTable, int RepLen, int Len) {
+static void SendRleLen(stream *Stream, const huftable *LenTable, int RepLen, int Len) {
 
    if (Len == 0) {
       while (RepLen >= 139) {
-         SendHufSym(LenTable,1); /* REPZ 11-138 */
-         SendBits(7,138-11);
+         SendHufSym(Stream,LenTable,1); /* REPZ 11-138 */
+         SendBits(Stream,7,138-11);
          RepLen -= 138;
       }
       if (RepLen >= 11) {
-         SendHufSym(LenTable,1); /* REPZ 11-138 */
-         SendBits(7,RepLen-11);
+         SendHufSym(Stream,LenTable,1); /* REPZ 11-138 */
+         SendBits(Stream,7,RepLen-11);
       } else if (RepLen >= 3) {
-         SendHufSym(LenTable,0); /* REPZ 3-10 */
-         SendBits(3,RepLen-3);
+         SendHufSym(Stream,LenTable,0); /* REPZ 3-10 */
+         SendBits(Stream,3,RepLen-3);
       } else {
-         while (--RepLen >= 0) SendHufSym(LenTable,3); /* 0 */
+         while (--RepLen >= 0) SendHufSym(Stream,LenTable,3); /* 0 */
       }
    } else {
-      SendHufSym(LenTable,Len+3); /* Len */
+      SendHufSym(Stream,LenTable,Len+3); /* Len */
       RepLen--;
       while (RepLen >= 7) {
-         SendHufSym(LenTable,2); /* REP 3-6 */
-         SendBits(2,6-3);
+         SendHufSym(Stream,LenTable,2); /* REP 3-6 */
+         SendBits(Stream,2,6-3);
          RepLen -= 6;
       }
       if (RepLen >= 3) {
-         SendHufSym(LenTable,2); /* REP 3-6 */
-         SendBits(2,RepLen-3);
+         SendHufSym(Stream,LenTable,2); /* REP 3-6 */
+         SendBits(Stream,2,RepLen-3);
       } else {
-         while (--RepLen >= 0) SendHufSym(LenTable,Len+3); /* Len */
+         while (--RepLen >= 0) SendHufSym(Stream,LenTable,Len+3); /* Len */
       }
    }
 }
 
 /* GetHufSym() */
 
-int GetHufSym(const huftable *HufTable) {
+int GetHufSym(stream *Stream, const huftable *HufTable) {
+
+   int Code, Len, LenMax;
+   uint Bits;
+   const codelen *CodeLen;
+
+   CodeLen = HufTable->CodeLen;
+   LenMax  = HufTable->CodeLenMax;
 
-   int Code, Len;
+   Bits = PeekBits(Stream,LenMax);
 
-   Len  = 0;
-   Code = 0;
+   Len = 1;
+   while ((Code = (int) (Bits >> (LenMax - Len))) < CodeLen[Len].CodeMin) Len++;
 
-   do {
-      Code = (Code << 1) | GetBit();
-      Len++;
-   } while (Code < CodeLen[Len].CodeMin);
+   ConsumeBits(Stream,Len);
 
-   return HufSymArray[Code+CodeLen[Len].HufSymIndex];
+   return HufTable->HufSymArray[Code+CodeLen[Len].HufSymIndex];
 }
 
 /* SendHufSym() */
 
-void SendHufSym(const huftable *HufTable, int Symbol) {
+void SendHufSym(stream *Stream, const huftable *HufTable, int Symbol) {
 
    hufsym *S; /* const */
 
@@ -557,7 +584,7 @@ void SendHufSym(const huftable *HufTable, int Symbol) {
    assert(S->Freq>0);
    assert(S->Len>0);
 
-   SendBits(S->Len,S->Code);
+   SendBits(Stream,S->Len,S->Code);
 
    S->Freq--;
 }
@@ -575,7 +602,7 @@ void CheckFreqs(const huftable *HufTable) {
 
 /* UpdateHeap() */
 
-static void UpdateHeap(int Root) {
+static void UpdateHeap(hufsym *Heap[], int HeapSize, int Root) {
 
    int Node, Son;
    hufsym *HufSym;
@@ -4,8 +4,12 @@
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
 
+#include "bitio.h"
+
 /* Constants */
 
+#define HUF_LEN_MAX 25
+
 enum { STORE, DELTA, HUFFMAN };
 
 /* Types */
@@ -20,10 +24,21 @@ struct hufsym {
 };
 
 typedef struct {
-   int     N;
-   int     LenMax;
-   int     Format;
-   hufsym *HufSym;
+   int HufSymNb;
+   int CodeMin;
+   int HufSymIndex;
+} codelen;
+
+typedef struct {
+   int      N;
+   int      LenMax;
+   int      Format;
+   hufsym  *HufSym;
+   hufsym **Heap;                      /* CompLens() work space */
+   hufsym  *Node;                      /* Internal nodes of the huffman tree */
+   codelen  CodeLen[HUF_LEN_MAX+1];    /* Canonical code description */
+   int      CodeLenMin, CodeLenMax;
+   int     *HufSymArray;               /* Decode table */
 } huftable;
 
 /* Prototypes */
@@ -33,16 +48,16 @@ extern void FreeHufTable    (huftable *HufTable);
 
 extern void CompLens        (huftable *HufTable, const int Freq[]);
 extern void CompCodes       (huftable *HufTable);
-extern void CompDecodeTable (const huftable *HufTable);
+extern void CompDecodeTable (huftable *HufTable);
 
 extern int  PredictLen      (const huftable *HufTable);
 extern int  PredictLens     (const huftable *HufTable);
 
-extern void GetLens         (huftable *HufTable);
-extern void SendLens        (const huftable *HufTable);
+extern void GetLens         (stream *Stream, huftable *HufTable);
+extern void SendLens        (stream *Stream, const huftable *HufTable);
 
-extern int  GetHufSym       (const huftable *HufTable);
-extern void SendHufSym      (const huftable *HufTable, int Symbol);
+extern int  GetHufSym       (stream *Stream, const huftable *HufTable);
+extern void SendHufSym      (stream *Stream, const huftable *HufTable, int Symbol);
 
 extern void CheckFreqs      (const huftable *HufTable);
 
@@ -1,29 +1,64 @@
 
 /* LZ77.C */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lz77.h"
 #include "types.h"
 #include "algo.h"
 #include "bitio.h"
+#include "crc.h"
 #include "debug.h"
+#include "delta.h"
 #include "huffman.h"
+#include "split.h"
+#include "thread.h"
 
 /* Constants */
 
-#define SYMBOL_NB      0x320
+#define LZH_DIST_BIT   5     /* Distance codes per length code, LZH (64 KB window) */
+#define LZX_DIST_BIT   6     /* LZX (2 GB window) */
+#define LEN_CODE_NB    17
+#define SYMBOL_NB      (0x100 + (LEN_CODE_NB << LZX_DIST_BIT))
 #define LEN_MAX        25
 #define FORMAT         HUFFMAN
 
-#define HASH_SIZE      1048576
-#define DIST_MAX       65535
-#define NONE           DIST_MAX
+#define HASH_BIT_MIN   8
+#define HASH_BIT_MAX   20
+#define INFO_NB        62
+
+#define NONE           (-1)
+
+#define OPT_CHUNK      16384 /* Positions parsed at once by BestLZ77() */
+#define OPT_PASS       2     /* Parses per chunk, each with refined prices */
+#define OPT_INFINITY   0x7FFFFFFF
 
 #define BLOCK_SIZE_MIN 1024
-#define BLOCK_SIZE_MAX 65536
-#define BLOCK_SIZE_BIT 16
+#define BLOCK_SIZE_BIT SPLIT_SIZE_BIT
+
+#define CHUNK_SIZE     8388608 /* Positions parsed before their tokens are sent */
+#define CHUNK_SEGMENT  8       /* Segments per chunk when threaded */
+#define SEGMENT_MIN    1048576 /* Positions parsed by a thread at once, at least 4 windows */
+
+#define LZH_WINDOW     65536   /* Decoder history when streaming, LZH distances are below */
+#define STREAM_CHUNK   1048576 /* Bytes decoded between two writes when streaming */
+
+#define TOKEN_BIT      11    /* Huffman code bits resolved by the decoder's fast table */
+#define COPY_SLACK     16    /* Bytes a match copy may write past its end */
+
+#define LONG_HASH_LEN  32    /* Bytes covered by the long match rolling hash */
+#define LONG_LEN_MIN   64    /* Shortest long match */
+#define LONG_ANCHOR    5     /* One position in 2^LONG_ANCHOR is indexed, chosen by content */
+#define LONG_BIT_MIN   10
+#define LONG_BIT_MAX   22
+#define LONG_REFILL    65536 /* Window refilled after a long match, if longer */
+#define LONG_PRIME     0x01000193U
+
+#define FAST_LEN_MIN   4     /* Shorter FAST matches cost more than their literals */
+#define FAST_RUN       15    /* Token nibble followed by extension bytes */
 
 /* Types */
 
@@ -34,821 +69,2057 @@ typedef struct {
 } info;
 
 typedef struct {
-   ushort Succ;
-   ushort Pred;
-} hash_node;
+   int Pos;
+   int Len;
+   int Dist;
+} match;
+
+typedef struct {
+   int Price;    /* Bits from the chunk start */
+   int Len;      /* Last token: 1 = literal */
+   int Dist;
+   int LastDist; /* Repeat distance after the last token */
+} opt_node;
 
 typedef struct {
-   ushort Head;
-   ushort Tail;
-} hash_list;
-
-typedef struct block_node block_node;
-
-struct block_node {
-   block_node *Succ;
-   block_node *Pred;
-   int         Start;
-   int         End;
-   int         Size;
-   int         Len;
-   int         MergeLen;
-   int         Freq[SYMBOL_NB];
-};
+   int   Len;     /* Match length without extra bits, 0 = literal */
+   int   Dist;    /* Distance without extra bits (0 = last distance), or literal */
+   uchar LenLen;  /* Extra length bits */
+   uchar DistLen; /* Extra distance bits */
+   uchar Bits;    /* Fast table: code + extra length bits, 0 = code too long */
+} token;
+
+typedef struct {
+   int Tree;     /* Binary tree match finder instead of hash chains */
+   int ChainMax; /* Hash chain (tree) nodes visited per position */
+   int GoodLen;  /* Match length that ends the search */
+   int LazyLen;  /* Try the next position only below this length (0 = never) */
+   int Optimal;  /* Price-driven parse (BestLZ77) */
+} level;
+
+typedef struct {
+   const uchar *S;        /* The block, from position Start, see Text() */
+   int          N;
+   uchar       *Seam;     /* Dictionary followed by the block's first LenMax bytes, NULL without a dictionary */
+   int          Verbosity;
+   int          DistMax;  /* Window size */
+   int          DistBit;  /* Distance code bits in a symbol */
+   int          CodeNb;   /* Huffman symbols */
+   int          ChainMax;
+   int          GoodLen;
+   int          LazyLen;
+   int          Tree;
+   int          Optimal;
+   int          HashBit;
+   int         *HashHead; /* Most recent position per hash key */
+   int         *HashNext; /* Previous position with the same key, per window position */
+   int         *TreeSon;  /* Smaller/greater suffix of each window position */
+   int          WindowMask; /* Window positions are indexed modulo a power of 2 > DistMax */
+   match        Match[259]; /* TreeMatch() results, one per length <= LenMax */
+   ushort      *Length;
+   int         *Distance;
+   int          SymbolNb;
+   int          TokenMax; /* Length[] and Distance[] size */
+   int          Start;    /* Parsing starts there, earlier positions (dictionary) only fill the window */
+   int          Pos;      /* Next position to parse */
+   int          End;      /* Tokens start below End, the last match may run past it */
+   int          Limit;    /* Tokens end there at most: next long match, else N */
+   int          ChunkSize;
+   int          ThreadNb;
+   int          SegmentSize; /* ThreadLZ77() */
+   int          Hashed;   /* Positions below are in the match finder */
+   int          NextLen;  /* FastLZ77(): match already searched at Pos, 0 if none */
+   int          NextDist;
+   int          LastDist; /* BestLZ77(): repeat distance */
+   int          SkipTo;   /* BestLZ77(): positions below are inside a long match */
+   int          Freq[SYMBOL_NB]; /* BestLZ77(): symbols chosen so far */
+   match       *Long;     /* LongLZ77() matches, by position; NULL if none */
+   int          LongNb;
+   int          LongNext; /* First one not yet sent */
+} lz77;
 
 typedef struct {
-   block_node *Head;
-   block_node *Tail;
-} block_list;
+   lz77        Lz[1];       /* Own match finder (the main one for the first), shared buffers */
+   const lz77 *Main;
+   int         First;       /* Segments First, First+Step, ... */
+   int         Step;
+   int         SegmentNb;   /* In the chunk */
+   int        *SymbolNb;    /* Tokens per segment */
+   thread      Thread[1];
+} worker;
 
 /* "constants" */
 
 static const int LenMin  = 3;
 static const int LenMax  = 259;
-static const int DistMax = 65535;
-
-static const info Info[32] = {
-   { 0x0000,  0,  0 },
-   { 0x0001,  1,  0 },
-   { 0x0002,  2,  0 },
-   { 0x0003,  3,  0 },
-   { 0x0004,  4,  1 },
-   { 0x0006,  5,  1 },
-   { 0x0008,  6,  2 },
-   { 0x000C,  7,  2 },
-   { 0x0010,  8,  3 },
-   { 0x0018,  9,  3 },
-   { 0x0020, 10,  4 },
-   { 0x0030, 11,  4 },
-   { 0x0040, 12,  5 },
-   { 0x0060, 13,  5 },
-   { 0x0080, 14,  6 },
-   { 0x00C0, 15,  6 },
-   { 0x0100, 16,  7 },
-   { 0x0180, 17,  7 },
-   { 0x0200, 18,  8 },
-   { 0x0300, 19,  8 },
-   { 0x0400, 20,  9 },
-   { 0x0600, 21,  9 },
-   { 0x0800, 22, 10 },
-   { 0x0C00, 23, 10 },
-   { 0x1000, 24, 11 },
-   { 0x1800, 25, 11 },
-   { 0x2000, 26, 12 },
-   { 0x3000, 27, 12 },
-   { 0x4000, 28, 13 },
-   { 0x6000, 29, 13 },
-   { 0x8000, 30, 14 },
-   { 0xC000, 31, 14 }
-};
 
-/* Variables */
-
-static hash_list  *HashList;
-static hash_node  *HashNode;
-
-static ushort     *Length;
-static ushort     *Distance;
-static int         SymbolNb;
+static const info Info[INFO_NB] = {
+   { 0x00000000,  0,  0 },
+   { 0x00000001,  1,  0 },
+   { 0x00000002,  2,  0 },
+   { 0x00000003,  3,  0 },
+   { 0x00000004,  4,  1 },
+   { 0x00000006,  5,  1 },
+   { 0x00000008,  6,  2 },
+   { 0x0000000C,  7,  2 },
+   { 0x00000010,  8,  3 },
+   { 0x00000018,  9,  3 },
+   { 0x00000020, 10,  4 },
+   { 0x00000030, 11,  4 },
+   { 0x00000040, 12,  5 },
+   { 0x00000060, 13,  5 },
+   { 0x00000080, 14,  6 },
+   { 0x000000C0, 15,  6 },
+   { 0x00000100, 16,  7 },
+   { 0x00000180, 17,  7 },
+   { 0x00000200, 18,  8 },
+   { 0x00000300, 19,  8 },
+   { 0x00000400, 20,  9 },
+   { 0x00000600, 21,  9 },
+   { 0x00000800, 22, 10 },
+   { 0x00000C00, 23, 10 },
+   { 0x00001000, 24, 11 },
+   { 0x00001800, 25, 11 },
+   { 0x00002000, 26, 12 },
+   { 0x00003000, 27, 12 },
+   { 0x00004000, 28, 13 },
+   { 0x00006000, 29, 13 },
+   { 0x00008000, 30, 14 },
+   { 0x0000C000, 31, 14 },
+   { 0x00010000, 32, 15 },
+   { 0x00018000, 33, 15 },
+   { 0x00020000, 34, 16 },
+   { 0x00030000, 35, 16 },
+   { 0x00040000, 36, 17 },
+   { 0x00060000, 37, 17 },
+   { 0x00080000, 38, 18 },
+   { 0x000C0000, 39, 18 },
+   { 0x00100000, 40, 19 },
+   { 0x00180000, 41, 19 },
+   { 0x00200000, 42, 20 },
+   { 0x00300000, 43, 20 },
+   { 0x00400000, 44, 21 },
+   { 0x00600000, 45, 21 },
+   { 0x00800000, 46, 22 },
+   { 0x00C00000, 47, 22 },
+   { 0x01000000, 48, 23 },
+   { 0x01800000, 49, 23 },
+   { 0x02000000, 50, 24 },
+   { 0x03000000, 51, 24 },
+   { 0x04000000, 52, 25 },
+   { 0x06000000, 53, 25 },
+   { 0x08000000, 54, 26 },
+   { 0x0C000000, 55, 26 },
+   { 0x10000000, 56, 27 },
+   { 0x18000000, 57, 27 },
+   { 0x20000000, 58, 28 },
+   { 0x30000000, 59, 28 },
+   { 0x40000000, 60, 29 },
+   { 0x60000000, 61, 29 }
+};
 
-static block_list  BlockList[1];
-static int         BlockNb;
-static int         BlockLen;
+static const int Period[8] = { 0, 8, 8, 9, 8, 10, 12, 14 }; /* Multiple of Dist >= 8 */
+
+static const level Level[LEVEL_MAX+1] = {
+   { FALSE,    0,   0,   0, FALSE },
+   { FALSE,    4,   8,   0, FALSE },
+   { FALSE,    8,  16,   0, FALSE },
+   { FALSE,   16,  32,   0, FALSE },
+   { FALSE,   16,  32,  16, FALSE },
+   { FALSE,   32,  64,  32, FALSE },
+   { FALSE,  128, 128, 128, FALSE },
+   { FALSE,  256, 259, 259, FALSE },
+   { TRUE,    64, 259, 259, FALSE },
+   { TRUE,   256, 259,   0, TRUE  }
+};
 
 /* Prototypes */
 
-static void AllocLZ77 (void);
-static void FreeLZ77  (void);
-
-static void FastLZ77  (void);
-static void SlowLZ77  (void);
-static void BestLZ77  (void);
+static void AllocLZ77 (lz77 *Lz, const codec *Codec);
+static void FreeLZ77  (lz77 *Lz);
+
+static void AllocHash (lz77 *Lz, int Size);
+static int  HashBit   (int Size);
+static void FreeHash  (lz77 *Lz);
+
+static void RestartLZ77 (lz77 *Lz, int Pos);
+static void ParseLZ77   (lz77 *Lz);
+static void LongLZ77    (lz77 *Lz);
+static void SendLong    (lz77 *Lz, match *Long, int End);
+static uint LongHash    (const uchar *S);
+static const uchar *Text (const lz77 *Lz, int P);
+
+static void FastLZ77  (lz77 *Lz);
+static void ThreadLZ77 (lz77 *Lz);
+static void WorkLZ77  (void *Data);
+static void SlowLZ77  (lz77 *Lz);
+static void BestLZ77  (lz77 *Lz);
+
+static void InitHash  (lz77 *Lz);
+static int  HashKey   (const lz77 *Lz, int P);
+static void AddHash   (lz77 *Lz, int P);
+
+static int  FindMatch  (lz77 *Lz, int P, int *Dist);
+static void SkipMatch  (lz77 *Lz, int P);
+static int  ChainMatch (lz77 *Lz, int P, int *Dist);
+static int  TreeMatch  (lz77 *Lz, int P, match *Match);
+static int  CommonLen (const uchar *S1, const uchar *S2, int Max);
+
+static void GetMatch  (const lz77 *Lz, match *Match, int P);
+static int  MatchCmp  (const void *M1, const void *M2);
 
-static void InitHash  (void);
-static int  HashKey   (int P);
-static void AddHash   (int P);
-static void RemHash   (int P);
+static void PriceSymbols (int Cost[], const int Freq[], huftable *HufTable);
+static void CountSymbols (const lz77 *Lz, int Freq[], int P, const int Len[], const int Dist[], int TokenNb, int LastDist);
 
-static int  MatchLen  (int P1, int P2);
+static int  BitCode   (int N);
 
-static int  MatchCmp  (const void *M1, const void *M2);
+static void   InitTokens (token Token[], int N, int DistBit);
+static void   CompTokens (token Fast[], const token Token[], const huftable *HufTable);
+static uchar *CopyMatch  (uchar *Dst, int Dist, int Len, const uchar *End);
+static void   FlushLZ77  (codec *Codec, const uchar *Block, int Size, uchar *Temp);
 
-static int  BitCode   (int N);
+static int    SendFast   (const lz77 *Lz, uchar *Buffer, int Pos);
+static uchar *SendRun    (uchar *Out, int Run);
 
 /* Functions */
 
 /* CodeLZ77() */
 
-void CodeLZ77(void) {
+void CodeLZ77(codec *Codec) {
 
-   int I, Len, Dist, LastDist, LiteralNb, StringNb, StringLen, StringDist;
-   int Start, Code, LenCode, DistCode, LenLen, DistLen;
-   int Gain, BestGain, Freq[SYMBOL_NB];
-   block_node *Block, *BestBlock;
+   int I, Len, Dist, LastDist, SymbolDist, LiteralNb, StringNb, StringLen, StringDist;
+   int B, Code, LenCode, DistCode, LenLen, DistLen;
+   ushort *Symbol;
+   split_block *Block;
+   split Split[1];
    huftable HufTable[1];
-   
-   AllocLZ77();
+   lz77 Lz[1];
+   stream *Out;
+
+   Out = Codec->Out;
+
+   if (Codec->Version >= 2) { /* Dictionary id */
+      SendBit(Out,Codec->Dict!=NULL);
+      if (Codec->Dict != NULL) SendBits(Out,32,CRC(Codec->Dict,Codec->DictSize));
+   }
 
-   Length   = Nalloc(N*sizeof(ushort),"LZ77 length array");
-   Distance = Nalloc(N*sizeof(ushort),"LZ77 distance array");
+   AllocLZ77(Lz,Codec);
 
-   FastLZ77();
+   AllocHufTable(HufTable,Lz->CodeNb,LEN_MAX,FORMAT);
+
+   Symbol = Nalloc((Lz->TokenMax+1)*sizeof(ushort),"LZ77 symbols");
 
    LiteralNb  = 0;
    StringNb   = 0;
    StringLen  = 0;
    StringDist = 0;
-   
-   for (I = 0; I < SymbolNb; I++) {
-      if (Length[I] >= LenMin) {
-         StringNb++;
-         StringLen  += Length[I];
-         StringDist += Distance[I];
-      } else {
-         LiteralNb++;
-      }
-   }
 
-   if (Verbosity >= 2) fprintf(stderr,"%d codes, %d literals (%.2f%%) and %d strings (%.2f%%), len %.2f, dist %.2f\n",LiteralNb+StringNb,LiteralNb,100.0*(double)LiteralNb/(double)(StringNb+LiteralNb),StringNb,100.0*(double)StringNb/(double)(StringNb+LiteralNb),(double)StringLen/(double)StringNb,(double)StringDist/(double)StringNb);
+   LastDist   = 1;
+   SymbolDist = 1;
 
-   AllocHufTable(HufTable,SYMBOL_NB,LEN_MAX,FORMAT);
+   if (Codec->Long && Codec->Algorithm == ALGO_LZX) LongLZ77(Lz); /* Far distances need LZX codes */
 
-   BlockList->Head = NULL;
-   BlockList->Tail = NULL;
-   
-   BlockNb  = 0;
-   BlockLen = 0;
+   RestartLZ77(Lz,Lz->Start);
 
-   LastDist = 1;
+   /* Tokens are collected, split into huffman blocks and sent one chunk */
+   /* at a time, so that memory doesn't grow with the block size         */
+
+   while (Lz->Pos < Lz->N) {
+
+      ParseLZ77(Lz);
 
-   for (Start = 0; Start < SymbolNb; Start += BLOCK_SIZE_MIN) {
-      
-      Block = Nalloc(sizeof(block_node),"LZ77 block node");
-      
-      Block->Start = Start;
-      Block->End = Block->Start + BLOCK_SIZE_MIN;
-      if (Block->End > SymbolNb) Block->End = SymbolNb;
-      Block->Size = Block->End - Block->Start;
-
-      for (I = 0; I < SYMBOL_NB; I++) Block->Freq[I] = 0;
-
-      for (I = Block->Start; I < Block->End; I++) {
-	 if (Length[I] >= LenMin) {
-	    Len     = Length[I] - LenMin;
-	    LenCode = BitCode(Len);
-            Dist    = Distance[I]; /* - 1 */
-            if (Dist == LastDist) {
+      for (I = 0; I < Lz->SymbolNb; I++) {
+         if (Lz->Length[I] >= LenMin) {
+            StringNb++;
+            StringLen  += Lz->Length[I];
+            StringDist += Lz->Distance[I];
+         } else {
+            LiteralNb++;
+         }
+      }
+
+      for (I = 0; I < Lz->SymbolNb; I++) {
+         if (Lz->Length[I] >= LenMin) {
+            Len     = Lz->Length[I] - LenMin;
+            LenCode = BitCode(Len);
+            Dist    = Lz->Distance[I]; /* - 1 */
+            if (Dist == SymbolDist) {
                Dist = 0;
             } else {
-               LastDist = Dist;
+               SymbolDist = Dist;
             }
-	    DistCode = BitCode(Dist);
-	    Code     = 0x100 + ((LenCode << 5) | DistCode);
-	 } else {
-	    Code = Distance[I];
-	 }
-	 Block->Freq[Code]++;
+            DistCode  = BitCode(Dist);
+            Symbol[I] = 0x100 + ((LenCode << Lz->DistBit) | DistCode);
+         } else {
+            Symbol[I] = Lz->Distance[I];
+         }
       }
 
-      CompLens(HufTable,Block->Freq);
-      Block->Len = PredictLen(HufTable);
+      SplitBlocks(Split,HufTable,Symbol,Lz->SymbolNb,BLOCK_SIZE_MIN,Codec->Group,Lz->Verbosity);
 
-      Block->Pred = BlockList->Tail;
-      Block->Succ = NULL;
+      for (B = Split->Head; B != SPLIT_NONE; B = Block->Succ) {
 
-      if (BlockList->Tail != NULL) {
-         BlockList->Tail->Succ = Block;
-      } else {
-         BlockList->Head = Block;
-      }
-      BlockList->Tail = Block;
+         Block = &Split->Block[B];
 
-      BlockNb++;
-      BlockLen += Block->Len;
-   }
+         SendBit(Out,1);
+
+         SendBits(Out,BLOCK_SIZE_BIT,Block->Size-1);
 
-   for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
-      if (Block->Succ != NULL) {
-         for (I = 0; I < SYMBOL_NB; I++) Freq[I] = Block->Freq[I] + Block->Succ->Freq[I];
-         CompLens(HufTable,Freq);
-         Block->MergeLen = PredictLen(HufTable);
+         CompLens(HufTable,BlockFreq(Split,Symbol,B));
+         SendLens(Out,HufTable);
+
+         CompCodes(HufTable);
+         for (I = Block->Start; I < Block->End; I++) {
+	    if (Lz->Length[I] >= LenMin) {
+	       Len      = Lz->Length[I] - LenMin;
+	       LenCode  = BitCode(Len);
+	       LenLen   = (Lz->Length[I] == LenMax) ? 0 : Info[LenCode].Len;
+               Dist     = Lz->Distance[I]; /* - 1 */
+               if (Dist == LastDist) {
+                  Dist = 0;
+               } else {
+                  LastDist = Dist;
+               }
+	       DistCode = BitCode(Dist);
+	       DistLen  = Info[DistCode].Len;
+	       Code     = 0x100 + ((LenCode << Lz->DistBit) | DistCode);
+	       SendHufSym(Out,HufTable,Code);
+	       if (LenLen  != 0) SendBits(Out,LenLen,Len-Info[LenCode].Start);
+	       if (DistLen != 0) SendBits(Out,DistLen,Dist-Info[DistCode].Start);
+	    } else {
+	       Code = Lz->Distance[I];
+	       SendHufSym(Out,HufTable,Code);
+	    }
+         }
       }
+
+      FreeSplit(Split);
    }
 
-   if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",BlockNb,(double)(LiteralNb+StringNb)/(double)BlockNb,(double)BlockLen/8.0);
+   if (Lz->Verbosity >= 2) fprintf(stderr,"%d codes, %d literals (%.2f%%) and %d strings (%.2f%%), len %.2f, dist %.2f\n",LiteralNb+StringNb,LiteralNb,100.0*(double)LiteralNb/(double)(StringNb+LiteralNb),StringNb,100.0*(double)StringNb/(double)(StringNb+LiteralNb),(double)StringLen/(double)StringNb,(double)StringDist/(double)StringNb);
 
-   if (Group) {
+   CheckFreqs(HufTable);
 
-      while (TRUE) {
+   SendBit(Out,0);
 
-         BestBlock = NULL;
-         BestGain  = -1;
+   Free(Symbol);
 
-         for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
-            if (Block->Succ != NULL && Block->Size + Block->Succ->Size <= BLOCK_SIZE_MAX) {
-               Gain = Block->Len + Block->Succ->Len - Block->MergeLen + BLOCK_SIZE_BIT + 1;
-               if (Gain > BestGain) {
-                  BestGain  = Gain;
-                  BestBlock = Block;
-               }
-            }
-         }
+   FreeHufTable(HufTable);
 
-         if (BestGain < 0) break;
+   FreeLZ77(Lz);
+}
 
-         BlockNb--;
-         BlockLen -= BestGain;
+/* DecodeLZ77() */
 
-         if (Verbosity >= 3) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f, Gain = %7.2f\n",BlockNb,(double)(LiteralNb+StringNb)/(double)BlockNb,(double)BlockLen/8.0,(double)BestGain/8.0);
+void DecodeLZ77(codec *Codec) {
 
-         BestBlock->End   = BestBlock->Succ->End;
-         BestBlock->Size += BestBlock->Succ->Size;
-         BestBlock->Len   = BestBlock->MergeLen;
+   int SymbolNb, Len, Dist, LastDist, DistBit, SymbolMax, DictSize, Size, Window, Base, Move;
+   uint Bits, Crc32;
+   uchar *S, *Out, *End, *Stop, *Flush, *Sent, *Temp;
+   const uchar *Dict;
+   const token *T;
+   token *Token, *Fast;
+   huftable HufTable[1];
+   stream *In;
 
-         for (I = 0; I < SYMBOL_NB; I++) BestBlock->Freq[I] += BestBlock->Succ->Freq[I];
+   S  = Codec->S;
+   In = Codec->In;
 
-         BestBlock->Succ = BestBlock->Succ->Succ;
+   Size   = Codec->N;
+   Window = 0;
+   Temp   = NULL;
 
-         if (BestBlock->Succ != NULL) {
-            BestBlock->Succ->Pred = BestBlock;
-            for (I = 0; I < SYMBOL_NB; I++) Freq[I] = BestBlock->Freq[I] + BestBlock->Succ->Freq[I];
-            CompLens(HufTable,Freq);
-            BestBlock->MergeLen = PredictLen(HufTable);
-         }
+   if (S == NULL) { /* Streamed to Codec->Out (if any), delta undone and CRC computed on the way */
 
-         if (BestBlock->Pred != NULL) {
-            for (I = 0; I < SYMBOL_NB; I++) Freq[I] = BestBlock->Pred->Freq[I] + BestBlock->Freq[I];
-            CompLens(HufTable,Freq);
-            BestBlock->Pred->MergeLen = PredictLen(HufTable);
-         }
+      Window = (Codec->Algorithm == ALGO_LZX) ? Codec->N : LZH_WINDOW; /* LZX windows aren't stored */
+      if (Size - Window > STREAM_CHUNK) Size = Window + STREAM_CHUNK;
+
+      S = Nalloc(Size+1,"LZ77 window");
+      if (Codec->Delta != 0) {
+         Temp = Nalloc(Size+DELTA_MAX,"LZ77 delta buffer");
+         memset(Temp,0,DELTA_MAX);
       }
 
-      if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",BlockNb,(double)(LiteralNb+StringNb)/(double)BlockNb,(double)BlockLen/8.0);
+      Codec->Crc = CRC_INIT;
    }
 
-   LastDist = 1;
+   Base = 0; /* Bytes slid out of the window */
 
-   for (Block = BlockList->Head; Block != NULL; Block = Block->Succ) {
+   Out   = S;
+   Sent  = S;
+   End   = S + Size;
+   Stop  = End;
+   Flush = (Codec->N > Size) ? End - LenMax : End;
 
-      SendBit(1);
+   Dict     = NULL;
+   DictSize = 0;
 
-      SendBits(BLOCK_SIZE_BIT,Block->Size-1);
+   if (Codec->Version >= 2 && GetBit(In) == 1) {
+      Crc32 = (uint) GetBits(In,32);
+      if (Codec->Dict == NULL) FatalError("DecodeLZ77(): a dictionary is needed");
+      if (CRC(Codec->Dict,Codec->DictSize) != Crc32) FatalError("DecodeLZ77(): wrong dictionary");
+      Dict     = Codec->Dict;
+      DictSize = Codec->DictSize;
+   }
 
-      CompLens(HufTable,Block->Freq);
-      SendLens(HufTable);
+   DistBit   = (Codec->Algorithm == ALGO_LZX) ? LZX_DIST_BIT : LZH_DIST_BIT;
+   SymbolMax = 0x100 + (LEN_CODE_NB << DistBit);
 
-      CompCodes(HufTable);
-      for (I = Block->Start; I < Block->End; I++) {
-	 if (Length[I] >= LenMin) {
-	    Len      = Length[I] - LenMin;
-	    LenCode  = BitCode(Len);
-	    LenLen   = (Length[I] == LenMax) ? 0 : Info[LenCode].Len;
-            Dist     = Distance[I]; /* - 1 */
-            if (Dist == LastDist) {
-               Dist = 0;
-            } else {
-               LastDist = Dist;
-            }
-	    DistCode = BitCode(Dist);
-	    DistLen  = Info[DistCode].Len;
-	    Code     = 0x100 + ((LenCode << 5) | DistCode);
-	    SendHufSym(HufTable,Code);
-	    if (LenLen  != 0) SendBits(LenLen,Len-Info[LenCode].Start);
-	    if (DistLen != 0) SendBits(DistLen,Dist-Info[DistCode].Start);
-	 } else {
-	    Code = Distance[I];
-	    SendHufSym(HufTable,Code);
-	 }
-      }
-   }
+   AllocHufTable(HufTable,SymbolMax,LEN_MAX,FORMAT);
 
-   CheckFreqs(HufTable);
+   Token = Nalloc(SymbolMax*sizeof(token),"LZ77 tokens");
+   Fast  = Nalloc((1<<TOKEN_BIT)*sizeof(token),"LZ77 decode table");
 
-   SendBit(0);
+   InitTokens(Token,SymbolMax,DistBit);
 
-   FreeHufTable(HufTable);
+   LastDist = 1;
 
-   Free(Length);
-   Free(Distance);
+   while (GetBit(In) == 1) {
 
-   FreeLZ77();
-}
+      SymbolNb = GetBits(In,BLOCK_SIZE_BIT) + 1;
 
-/* DecodeLZ77() */
+      GetLens(In,HufTable);
 
-void DecodeLZ77(void) {
+      CompCodes(HufTable);
+      CompDecodeTable(HufTable);
 
-   int I, SymbolNb, Len, Dist, LastDist, Code, LenCode, DistCode, LenLen, DistLen;
-   huftable HufTable[1];
+      CompTokens(Fast,Token,HufTable);
 
-   I = 0;
+      do {
 
-   AllocHufTable(HufTable,SYMBOL_NB,LEN_MAX,FORMAT);
+         if (Out > Flush) { /* Streaming: send the new bytes, slide the window */
 
-   LastDist = 1;
+            FlushLZ77(Codec,Sent,Out-Sent,Temp);
 
-   while (GetBit() == 1) {
+            Move = (Out - S) - Window;
+            memmove(S,S+Move,(size_t)Window);
 
-      SymbolNb = GetBits(BLOCK_SIZE_BIT) + 1;
+            Base    += Move;
+            Out     -= Move;
+            Sent     = Out;
+            DictSize = 0; /* Out of reach */
 
-      GetLens(HufTable);
+            Stop  = (Codec->N - Base > Size) ? End : S + (Codec->N - Base);
+            Flush = (Codec->N - Base > Size) ? End - LenMax : End;
+         }
 
-      CompCodes(HufTable);
-      CompDecodeTable(HufTable);
+         /* Short codes and their extra length bits come from one peek */
 
-      do {
-	 Code = GetHufSym(HufTable);
-	 if (Code >= 0x100) {
-	    Code     -= 0x100;
-	    LenCode   = Code >> 5;
-	    if (LenCode < 16) {
-	       Len    = Info[LenCode].Start + LenMin;
-	       LenLen = Info[LenCode].Len;
-	    } else {
-	       Len    = LenMax;
-	       LenLen = 0;
-	    }
-	    DistCode = Code & 0x1F;
-	    Dist     = Info[DistCode].Start; /* + 1 */
-	    DistLen  = Info[DistCode].Len;
-	    if (LenLen  != 0) Len  += GetBits(LenLen);
-	    if (DistLen != 0) Dist += GetBits(DistLen);
-            if (Dist == 0) {
-               Dist = LastDist;
-            } else {
-               LastDist = Dist;
-            }
-	    do {
-	       S[I] = S[I-Dist];
-	       I++;
-	    } while (--Len > 0);
-	 } else {
-	    S[I++] = Code; /* Literal */
-	 }
-      } while (--SymbolNb > 0);
-   }
+         Bits = PeekBits(In,32);
+         T    = &Fast[Bits>>(32-TOKEN_BIT)];
 
-   FreeHufTable(HufTable);
-}
+         if (T->Bits != 0) {
+            Len = T->Len + (int) ((Bits >> (32 - T->Bits)) & ((1U << T->LenLen) - 1));
+            ConsumeBits(In,T->Bits);
+         } else {
+            T   = &Token[GetHufSym(In,HufTable)];
+            Len = T->Len;
+            if (T->LenLen != 0) Len += (int) GetBits(In,T->LenLen);
+         }
 
-/* AllocLZ77() */
+         if (Len == 0) { /* Literal */
+            if (Out >= Stop) FatalError("DecodeLZ77(): corrupt input");
+            *Out++ = (uchar) T->Dist;
+            continue;
+         }
 
-static void AllocLZ77(void) {
+         Dist = T->Dist;
+         if (T->DistLen != 0) Dist += (int) GetBits(In,T->DistLen);
+         if (Dist == 0) {
+            Dist = LastDist;
+         } else {
+            LastDist = Dist;
+         }
 
-   HashList = Nalloc(HASH_SIZE*sizeof(hash_list),"LZ77 hash array");
-   HashNode = Nalloc(DIST_MAX*sizeof(hash_node),"LZ77 hash window");
-}
+         if (Dist > (Out - S) + DictSize || Len > Stop - Out) FatalError("DecodeLZ77(): corrupt input");
 
-/* FreeLZ77() */
+         if (Dist > Out - S) { /* Starts in the dictionary */
+            for (; Len > 0 && Dist > Out - S; Len--, Out++) *Out = Dict[DictSize-Dist+(Out-S)];
+            if (Len == 0) continue;
+         }
 
-static void FreeLZ77(void) {
+         Out = CopyMatch(Out,Dist,Len,End);
 
-   if (HashList != NULL) {
-      Free(HashList);
-      HashList = NULL;
+      } while (--SymbolNb > 0);
    }
 
-   if (HashNode != NULL) {
-      Free(HashNode);
-      HashNode = NULL;
+   if (Codec->S == NULL) {
+      FlushLZ77(Codec,Sent,Out-Sent,Temp);
+      if (Temp != NULL) Free(Temp);
+      Free(S);
    }
+
+   Free(Fast);
+   Free(Token);
+
+   FreeHufTable(HufTable);
 }
 
-/* FastLZ77() */
+/* CodeFast() */
 
-static void FastLZ77(void) {
+void CodeFast(codec *Codec) {
 
-   int I, J, K, P, LastP, Index, Len, BestLen, BestDist;
+   int Pos, Size;
+   uchar *Buffer;
+   lz77 Lz[1];
+   stream *Out;
 
-   LastP = 0;
+   Out = Codec->Out;
 
-   if (Verbosity >= 2) {
-      LastP = 0;
-      fprintf(stderr,"Collecting strings ... %2d%%",LastP);
-      fflush(stderr);
-   }
+   SendBit(Out,Codec->Dict!=NULL); /* Dictionary id */
+   if (Codec->Dict != NULL) SendBits(Out,32,CRC(Codec->Dict,Codec->DictSize));
 
-   SymbolNb = 0;
-   InitHash();
+   AllocLZ77(Lz,Codec);
 
-   if (N > 0) {
-      Length[SymbolNb]   = 1;
-      Distance[SymbolNb] = S[0];
-      SymbolNb++;
-      AddHash(0);
-   }
+   /* A chunk of input => a byte-aligned run of sequences */
 
-   Index = (DistMax > 1) ? 0 : 1;
+   Buffer = Nalloc(Lz->TokenMax+Lz->TokenMax/255+16,"FAST buffer");
 
-   for (I = 1; I <= N-LenMin; SymbolNb++) {
+   RestartLZ77(Lz,Lz->Start);
 
-      if (Verbosity >= 2) {
-         P = 100 * I / N;
-         if (P != LastP) {
-            LastP = P;
-            fprintf(stderr,"\b\b\b%2d%%",LastP);
-            fflush(stderr);
-         }
-      }
+   while (Lz->Pos < Lz->N) {
 
-      if (I >= Index + DistMax) Index += DistMax;
-      BestLen  = 1;
-      BestDist = 0;
+      Pos = Lz->Pos;
+      ParseLZ77(Lz);
 
-      for (J = HashList[HashKey(I)].Head; J != NONE; J = HashNode[J].Succ) {
-	 K = Index + J;
-	 if (K >= I) K -= DistMax;
-	 Len = MatchLen(K,I);
-	 if (Len >= LenMin && Len > BestLen) {
-	    BestLen  = Len;
-	    BestDist = I - K;
-	    if (Len >= LenMax) break;
-	 }
-      }
+      Size = SendFast(Lz,Buffer,Pos);
 
-      Length[SymbolNb] = BestLen;
-      if (BestLen >= LenMin) {
-         Distance[SymbolNb] = BestDist;
-      } else {
-         Distance[SymbolNb] = S[I];
-      }
+      SendBit(Out,1);
+      SendSize(Out,Size);
 
-      do {
-         if (I >= DistMax) RemHash(I-DistMax);
-         AddHash(I);
-         I++;
-      } while (--BestLen > 0);
+      CloseBitStream(Out);
+      SendBlock(Out,Buffer,Size);
+      OpenBitStream(Out);
    }
 
-   for (; I < N; I++, SymbolNb++) {
-      Length[SymbolNb]   = 1;
-      Distance[SymbolNb] = S[I];
-   }
+   SendBit(Out,0);
 
-   if (Verbosity >= 2) fprintf(stderr,"\b\b\bDone.\n");
+   Free(Buffer);
+
+   FreeLZ77(Lz);
 }
 
-/* SlowLZ77() */
+/* DecodeFast() */
 
-static void SlowLZ77(void) {
+void DecodeFast(codec *Codec) {
 
-   int I, J, K, P, LastP, Index, Len, BestLen, BestDist, StringNb, *Match;
+   int Size, Avail, TempSize, Lit, Len, Dist, DictSize, C, Token;
+   uint Crc32;
+   long Pos;
+   uchar *S, *Out, *End, *Temp;
+   const uchar *Dict, *In, *InEnd, *Block;
+   stream *Stream;
 
-   LastP = 0;
+   Stream = Codec->In;
 
-   if (Verbosity >= 2) {
-      LastP = 0;
-      fprintf(stderr,"Collecting strings ... %2d%%",LastP);
-      fflush(stderr);
-   }
+   S   = Codec->S;
+   Out = S;
+   End = S + Codec->N;
 
-   StringNb = 0;
-   InitHash();
+   Dict     = NULL;
+   DictSize = 0;
 
-   if (N > 0) {
-      Length[0] = 1;
-      AddHash(0);
+   if (GetBit(Stream) == 1) {
+      Crc32 = (uint) GetBits(Stream,32);
+      if (Codec->Dict == NULL) FatalError("DecodeFast(): a dictionary is needed");
+      if (CRC(Codec->Dict,Codec->DictSize) != Crc32) FatalError("DecodeFast(): wrong dictionary");
+      Dict     = Codec->Dict;
+      DictSize = Codec->DictSize;
    }
 
-   Index = (DistMax > 1) ? 0 : 1;
+   Temp     = NULL;
+   TempSize = 0;
 
-   for (I = 1; I <= N-LenMin; I++) {
+   while (GetBit(Stream) == 1) {
 
-      if (Verbosity >= 2) {
-         P = 100 * I / N;
-         if (P != LastP) {
-            LastP = P;
-            fprintf(stderr,"\b\b\b%2d%%",LastP);
-            fflush(stderr);
-         }
-      }
+      Size = (int) GetSize(Stream);
+      if (Size <= 0 || Size - 16 - Codec->N / 255 > Codec->N) FatalError("DecodeFast(): corrupt input");
 
-      if (I >= Index + DistMax) Index += DistMax;
-      BestLen  = 1;
-      BestDist = 0;
+      CloseBitStream(Stream);
+
+      /* Sequences are read in place from a mapped stream, copied otherwise */
 
-      for (J = HashList[HashKey(I)].Head; J != NONE; J = HashNode[J].Succ) {
-	 K = Index + J;
-	 if (K >= I) K -= DistMax;
-	 Len = MatchLen(K,I);
-	 if (Len >= LenMin && Len > BestLen) {
-	    BestLen  = Len;
-	    BestDist = I - K;
-	    if (Len == LenMax) break;
-	 }
+      In = NULL;
+
+      if (Stream->Type == STREAM_MEMORY) {
+         Block = MemStreamData(Stream,&Avail);
+         Pos   = TellStream(Stream);
+         if (Avail - Pos >= Size) {
+            In = Block + Pos;
+            SeekStream(Stream,Pos+Size);
+         }
       }
 
-      if (BestLen >= LenMin) {
-         Length[I]   = BestLen;
-         Distance[I] = BestDist;
-         StringNb++;
-      } else {
-         Length[I] = 1;
+      if (In == NULL) {
+         if (Size > TempSize) {
+            if (Temp != NULL) Free(Temp);
+            Temp     = Nalloc(Size,"FAST buffer");
+            TempSize = Size;
+         }
+         if (GetBlock(Stream,Temp,Size) != Size) FatalError("DecodeFast(): truncated input");
+         In = Temp;
       }
 
-      if (I >= DistMax) RemHash(I-DistMax);
-      AddHash(I);
-   }
+      OpenBitStream(Stream);
 
-   while (I < N) Length[I++] = 1;
+      InEnd = In + Size;
 
-   if (Verbosity >= 2) fprintf(stderr,"\b\b\bDone.\n");
+      while (TRUE) {
 
-   Match = Nalloc(StringNb*sizeof(int),"LZ77 match array");
+         Token = *In++;
 
-   for (I = 0, J = 0; I < N; I++) if (Length[I] >= LenMin) Match[J++] = I;
+         Lit = Token >> 4;
+         if (Lit == FAST_RUN) {
+            do {
+               if (In >= InEnd || Lit > End - Out) FatalError("DecodeFast(): corrupt input");
+               C = *In++;
+               Lit += C;
+            } while (C == 255);
+         }
 
-   if (Verbosity >= 2) {
-      fprintf(stderr,"Sorting matches    ... ");
-      fflush(stderr);
-   }
+         if (Lit > InEnd - In || Lit > End - Out) FatalError("DecodeFast(): corrupt input");
 
-   qsort(Match,(size_t)StringNb,sizeof(int),&MatchCmp);
+         if (Lit <= 16 && InEnd - In >= 16 && End - Out >= 16) { /* Most runs are short */
+            memcpy(Out,In,16);
+         } else {
+            memcpy(Out,In,(size_t)Lit);
+         }
 
-   if (Verbosity >= 2) {
+         Out += Lit;
+         In  += Lit;
 
-      fprintf(stderr,"Done.\n");
+         if (In == InEnd) break; /* Literals only, last sequence */
 
-      fprintf(stderr,"Selecting matches  ... ");
-      fflush(stderr);
-   }
+         if (InEnd - In < 2) FatalError("DecodeFast(): corrupt input");
 
-   for (I = 0; I < StringNb; I++) {
-      J = Match[I];
-      if (Length[J] >= LenMin) {
-         for (K = J+1; K < J+Length[J]; K++) {
-            if (Length[K] >= Length[J] && MatchCmp(&J,&K) > 0) {
-	       Length[J] = K - J;
-               break;
-            }
-            Length[K] = 1;
+         Dist = In[0] | (In[1] << 8);
+         In  += 2;
+
+         Len = Token & 15;
+         if (Len == FAST_RUN) {
+            do {
+               if (In >= InEnd || Len > End - Out) FatalError("DecodeFast(): corrupt input");
+               C = *In++;
+               Len += C;
+            } while (C == 255);
          }
-      }
-   }
+         Len += FAST_LEN_MIN;
 
-   if (Verbosity >= 2) fprintf(stderr,"Done.\n");
+         if (Dist == 0 || Dist > (Out - S) + DictSize || Len > End - Out) FatalError("DecodeFast(): corrupt input");
 
-   Free(Match);
+         if (Dist > Out - S) { /* Starts in the dictionary */
+            for (; Len > 0 && Dist > Out - S; Len--, Out++) *Out = Dict[DictSize-Dist+(Out-S)];
+            if (Len == 0) {
+               if (In == InEnd) break;
+               continue;
+            }
+         }
 
-   for (I = 0, J = 0; I < N; J++) {
-      if (Length[I] >= LenMin) {
-         Length[J]   = Length[I];
-         Distance[J] = Distance[I];
-         I += Length[I];
-      } else {
-         Length[J]   = 1;
-         Distance[J] = S[I];
-         I++;
+         Out = CopyMatch(Out,Dist,Len,End);
+
+         if (In == InEnd) break; /* Ends with a match */
       }
    }
 
-   SymbolNb = J;
+   if (Out != End) FatalError("DecodeFast(): corrupt input");
+
+   if (Temp != NULL) Free(Temp);
 }
 
-/* BestLZ77() */
+/* AllocLZ77() */
 
-static void BestLZ77(void) {
+static void AllocLZ77(lz77 *Lz, const codec *Codec) {
 
-   int I, J, K, P, LastP, Index, Len, BestLen, BestDist, StringNb;
-   int *Size, CurrSize, BestSize;
+   int Size;
 
-   LastP = 0;
+   Lz->Verbosity = Codec->Verbosity;
 
-   if (Verbosity >= 2) {
-      LastP = 0;
-      fprintf(stderr,"Collecting strings ... %2d%%",LastP);
-      fflush(stderr);
-   }
+   Lz->S    = Codec->S;
+   Lz->N    = Codec->N;
+   Lz->Seam = NULL;
 
-   StringNb = 0;
-   InitHash();
+   if (Codec->Dict != NULL && Codec->Version >= 2) {
+
+      /* The block is parsed as if the dictionary preceded it; only the */
+      /* strings starting in the dictionary need the block's first bytes */
+
+      Size = (Codec->N < LenMax) ? Codec->N : LenMax;
 
-   if (N > 0) {
-      Length[0] = 1;
-      AddHash(0);
+      Lz->Seam = Nalloc(Codec->DictSize+Size+1,"LZ77 dictionary");
+      memcpy(Lz->Seam,Codec->Dict,(size_t)Codec->DictSize);
+      memcpy(Lz->Seam+Codec->DictSize,Codec->S,(size_t)Size);
+
+      Lz->N += Codec->DictSize;
    }
 
-   Index = (DistMax > 1) ? 0 : 1;
+   Lz->Start = Lz->N - Codec->N;
 
-   for (I = 1; I <= N-LenMin; I++) {
+   if (Codec->Algorithm == ALGO_LZX) {
+      assert(Codec->Window>=WINDOW_MIN&&Codec->Window<=WINDOW_MAX);
+      Lz->DistMax = (1 << Codec->Window) - 1;
+      Lz->DistBit = LZX_DIST_BIT;
+   } else {
+      Lz->DistMax = 65535;
+      Lz->DistBit = LZH_DIST_BIT;
+   }
 
-      if (Verbosity >= 2) {
-         P = 100 * I / N;
-         if (P != LastP) {
-            LastP = P;
-            fprintf(stderr,"\b\b\b%2d%%",LastP);
-            fflush(stderr);
-         }
-      }
+   if (Lz->DistMax > Lz->N) Lz->DistMax = (Lz->N > 0) ? Lz->N : 1; /* Farther is useless */
 
-      if (I >= Index + DistMax) Index += DistMax;
-      BestLen  = 1;
-      BestDist = 0;
+   Lz->CodeNb = 0x100 + (LEN_CODE_NB << Lz->DistBit);
 
-      for (J = HashList[HashKey(I)].Head; J != NONE; J = HashNode[J].Succ) {
-	 K = Index + J;
-	 if (K >= I) K -= DistMax;
-	 Len = MatchLen(K,I);
-	 if (Len >= LenMin && Len > BestLen) {
-	    BestLen  = Len;
-	    BestDist = I - K;
-	    if (Len == LenMax) break;
-	 }
-      }
+   assert(Codec->Level>=LEVEL_MIN&&Codec->Level<=LEVEL_MAX);
 
-      if (BestLen >= LenMin) {
-         Length[I]   = BestLen;
-         Distance[I] = BestDist;
-         StringNb++;
-      } else {
-         Length[I] = 1;
-      }
+   Lz->ChainMax  = Level[Codec->Level].ChainMax;
+   Lz->GoodLen   = Level[Codec->Level].GoodLen;
+   Lz->LazyLen   = Level[Codec->Level].LazyLen;
+   Lz->Tree      = Level[Codec->Level].Tree;
+   Lz->Optimal   = Level[Codec->Level].Optimal;
 
-      if (I >= DistMax) RemHash(I-DistMax);
-      AddHash(I);
+   if (Codec->Algorithm == ALGO_FAST && Lz->Optimal) { /* Prices are huffman code lengths */
+      Lz->Optimal = FALSE;
+      Lz->LazyLen = LenMax;
    }
 
-   while (I < N) Length[I++] = 1;
+   assert(Lz->Tree||!Lz->Optimal);
 
-   if (Verbosity >= 2) {
+   AllocHash(Lz,Lz->N);
 
-      fprintf(stderr,"\b\b\bDone.\n");
+   /* Threads parse whole segments of a few windows each, see ThreadLZ77() */
 
-      fprintf(stderr,"Selecting matches  ... ");
-      fflush(stderr);
-   }
+   Size = Lz->N - Lz->Start;
 
-   Size = Nalloc((N+1)*sizeof(int),"LZ77 size array");
+   Lz->ThreadNb    = 1;
+   Lz->SegmentSize = SEGMENT_MIN;
+   if (Lz->SegmentSize / 4 <= Lz->DistMax) Lz->SegmentSize = (Lz->DistMax < Size / 4) ? 4 * (Lz->DistMax + 1) : Size;
 
-   Size[N] = 0;
-   BestLen = 0;
+   if (Codec->Threads > 1 && ThreadSupport() && ! Lz->Optimal && Lz->SegmentSize < Size) Lz->ThreadNb = Codec->Threads;
 
-   for (I = N-1; I >= 0; I--) {
-      if (Length[I] >= LenMin) {
-         BestSize = 999999999;
-         for (Len = Length[I]; Len >= LenMin; Len--) {
-            CurrSize = Size[I+Len] + 1;
-            if (CurrSize < BestSize) {
-               BestLen  = Len;
-               BestSize = CurrSize;
-            }
-         }
-         Len = 1;
-         CurrSize = Size[I+Len] + 1;
-         if (CurrSize < BestSize) {
-            BestLen  = Len;
-            BestSize = CurrSize;
-         }
-         Length[I] = BestLen;
-         Size[I]   = Size[I+Length[I]] + 1;
-      } else {
-         Size[I] = Size[I+Length[I]] + 1;
-      }
-   }
+   Lz->ChunkSize = CHUNK_SIZE;
+   if (Lz->ThreadNb > 1) Lz->ChunkSize = (Lz->SegmentSize <= Size / CHUNK_SEGMENT) ? CHUNK_SEGMENT * Lz->SegmentSize : Size;
 
-   Free(Size);
+   /* A chunk has at most one token per position, BestLZ77() may parse */
+   /* one OPT_CHUNK beyond its end                                    */
 
-   if (Verbosity >= 2) fprintf(stderr,"Done.\n");
+   Lz->TokenMax = Lz->ChunkSize + OPT_CHUNK + LenMax;
+   if (Lz->TokenMax > Size) Lz->TokenMax = Size;
 
-   for (I = 0, J = 0; I < N; J++) {
-      if (Length[I] >= LenMin) {
-         Length[J]   = Length[I];
-         Distance[J] = Distance[I];
-         I += Length[I];
-      } else {
-         Length[J]   = 1;
-         Distance[J] = S[I];
-         I++;
-      }
-   }
+   Lz->Length   = Nalloc(Lz->TokenMax*sizeof(ushort),"LZ77 length array");
+   Lz->Distance = Nalloc(Lz->TokenMax*sizeof(int),"LZ77 distance array");
+   Lz->SymbolNb = 0;
 
-   SymbolNb = J;
+   Lz->Limit    = Lz->N;
+   Lz->Long     = NULL;
+   Lz->LongNb   = 0;
+   Lz->LongNext = 0;
 }
 
-/* HashKey() */
+/* AllocHash() */
 
-static int HashKey(int P) {
+static void AllocHash(lz77 *Lz, int Size) {
 
-   return (S[P] << 12) ^ S[P+1] ^ (S[P+2] << 6);
-}
+   int Ring;
 
-/* InitHash() */
+   /* Tables grow with the positions indexed (Size, at most the block): */
+   /* small files don't pay for a big window                           */
 
-static void InitHash(void) {
+   Lz->HashBit = HashBit(Size);
 
-   int I;
+   for (Ring = 1; Ring <= Lz->DistMax; Ring <<= 1)
+      ;
+   Lz->WindowMask = Ring - 1;
 
-   for (I = 0; I < HASH_SIZE; I++) {
-      HashList[I].Head = NONE;
-      HashList[I].Tail = NONE;
-   }
+   assert(Ring<=INT_MAX/(2*(int)sizeof(int))); /* See WINDOW_MAX */
+
+   Lz->HashHead = Nalloc((1<<Lz->HashBit)*sizeof(int),"LZ77 hash heads");
+   Lz->HashNext = NULL;
+   Lz->TreeSon  = NULL;
 
-   for (I = 0; I < DistMax; I++) {
-      HashNode[I].Pred = NONE;
-      HashNode[I].Succ = NONE;
+   if (Lz->Tree) {
+      Lz->TreeSon  = Nalloc(2*Ring*sizeof(int),"LZ77 tree window");
+   } else {
+      Lz->HashNext = Nalloc(Ring*sizeof(int),"LZ77 hash window");
    }
 }
 
-/* AddHash() */
+/* HashBit() */
+
+static int HashBit(int Size) {
+
+   int Bit;
 
-static void AddHash(int P) {
+   for (Bit = HASH_BIT_MIN; Bit < HASH_BIT_MAX && (1 << Bit) < Size; Bit++)
+      ;
 
-   int Key, Index;
+   return Bit;
+}
 
-   Key   = HashKey(P);
-   Index = P % DistMax;
+/* FreeLZ77() */
 
-   HashNode[Index].Pred = NONE;
-   HashNode[Index].Succ = HashList[Key].Head;
+static void FreeLZ77(lz77 *Lz) {
 
-   if (HashList[Key].Head == NONE) {
-      HashList[Key].Tail = Index;
-   } else {
-      HashNode[HashList[Key].Head].Pred = Index;
+   FreeHash(Lz);
+
+   if (Lz->Length != NULL) {
+      Free(Lz->Length);
+      Lz->Length = NULL;
    }
 
-   HashList[Key].Head = Index;
-}
+   if (Lz->Distance != NULL) {
+      Free(Lz->Distance);
+      Lz->Distance = NULL;
+   }
 
-/* RemHash() */
+   if (Lz->Seam != NULL) {
+      Free(Lz->Seam);
+      Lz->Seam = NULL;
+   }
 
-static void RemHash(int P) {
+   if (Lz->Long != NULL) {
+      Free(Lz->Long);
+      Lz->Long = NULL;
+   }
+}
 
-   int Key, Index;
+/* FreeHash() */
 
-   Key   = HashKey(P);
-   Index = P % DistMax;
+static void FreeHash(lz77 *Lz) {
 
-   HashList[Key].Tail = HashNode[Index].Pred;
+   if (Lz->HashHead != NULL) {
+      Free(Lz->HashHead);
+      Lz->HashHead = NULL;
+   }
 
-   if (HashNode[Index].Pred == NONE) {
-      HashList[Key].Head = NONE;
-   } else {
-      HashNode[HashNode[Index].Pred].Succ = NONE;
+   if (Lz->HashNext != NULL) {
+      Free(Lz->HashNext);
+      Lz->HashNext = NULL;
    }
 
-   HashNode[Index].Pred = NONE;
-   HashNode[Index].Succ = NONE;
+   if (Lz->TreeSon != NULL) {
+      Free(Lz->TreeSon);
+      Lz->TreeSon = NULL;
+   }
 }
 
-/* MatchLen() */
+/* RestartLZ77() */
 
-static int MatchLen(int P1, int P2) {
+static void RestartLZ77(lz77 *Lz, int Pos) {
 
-   int P0, P3;
+   int I;
 
-   if (S[P1+2] != S[P2+2]) return 0;
+   /* Empty match finder, parsing from Pos; the window before it gets */
+   /* (re)filled as parsing goes                                      */
 
-   /* Match of at least 3 chars due to hash key nature */
+   InitHash(Lz);
 
-   P0 = P1;
+   Lz->Pos      = Pos;
+   Lz->End      = Pos;
+   Lz->Hashed   = (Pos > Lz->DistMax) ? Pos - Lz->DistMax : 0;
+   Lz->NextLen  = 0;
+   Lz->NextDist = 0;
+   Lz->LastDist = 1;
+   Lz->SkipTo   = Pos;
 
-   P3 = P2 + LenMax;
-   if (P3 > N) P3 = N;
+   for (I = 0; I < SYMBOL_NB; I++) Lz->Freq[I] = 0;
+}
 
-   P1 += 3;
-   P2 += 3;
+/* ParseLZ77() */
 
-   while (P2 < P3 && S[P1] == S[P2]) {
-      P1++;
-      P2++;
-   }
+static void ParseLZ77(lz77 *Lz) {
 
-   return P1 - P0;
-}
+   int End;
+   match *Long;
 
-/* MatchCmp() */
+   /* Tokens for the next chunk, from Lz->Pos */
 
-static int MatchCmp(const void *M1, const void *M2) {
+   End = (Lz->N - Lz->End > Lz->ChunkSize) ? Lz->End + Lz->ChunkSize : Lz->N;
+
+   Lz->SymbolNb = 0;
 
-   int I1, I2, L1, L2, D1, D2;
+   while (Lz->Pos < End) {
 
-   I1 = *((const int *) M1);
-   I2 = *((const int *) M2);
+      /* Long matches the parser ran into are cut, dropped when too short */
 
-   L1 = Length[I1];
-   L2 = Length[I2];
+      for (Long = NULL; Lz->LongNext < Lz->LongNb; Lz->LongNext++) {
+         Long = &Lz->Long[Lz->LongNext];
+         if (Long->Pos < Lz->Pos) {
+            Long->Len -= Lz->Pos - Long->Pos;
+            Long->Pos  = Lz->Pos;
+         }
+         if (Long->Len >= LenMin) break;
+         Long = NULL;
+      }
+
+      if (Long != NULL && Long->Pos == Lz->Pos) {
+         SendLong(Lz,Long,End);
+         continue;
+      }
 
-   if (L1 != L2) return L2 - L1;
+      /* The gap before the next long match, tokens stop at its start */
 
-   D1 = Distance[I1];
-   D2 = Distance[I2];
+      Lz->End   = (Long != NULL && Long->Pos < End) ? Long->Pos : End;
+      Lz->Limit = (Long != NULL) ? Long->Pos : Lz->N;
 
-   if (D1 != D2) return D1 - D2;
+      if (Lz->Optimal) {
+         BestLZ77(Lz);
+      } else if (Lz->ThreadNb > 1 && (Lz->Long == NULL || Lz->End - Lz->Pos >= Lz->SegmentSize)) {
+         ThreadLZ77(Lz);
+      } else {
+         if (Lz->Pos - Lz->Hashed > Lz->DistMax) { /* Behind threaded gaps */
+            InitHash(Lz);
+            Lz->Hashed = Lz->Pos - Lz->DistMax;
+         }
+         FastLZ77(Lz);
+      }
+   }
 
-   return I1 - I2;
+   Lz->End = End;
 }
 
-/* BitCode() */
+/* LongLZ77() */
 
-static int BitCode(int N) {
+static void LongLZ77(lz77 *Lz) {
 
-   int BitCode;
+   int P, Q, Len, Max, Back, Covered, Bit, Slot, LongMax, *Table;
+   uint Hash, Key, Pow;
+
+   /* Indexes the whole input by a rolling hash, at positions picked by */
+   /* content so that repeats share them wherever they are, and keeps   */
+   /* the long matches found that way, at any distance                 */
 
-   for (BitCode = 0; BitCode < 31 && N >= Info[BitCode+1].Start; BitCode++)
+   if (Lz->N - Lz->Start < LONG_LEN_MIN) return;
+
+   for (Bit = LONG_BIT_MIN; Bit < LONG_BIT_MAX && (Lz->N >> LONG_ANCHOR) > (1 << Bit); Bit++)
       ;
 
-   return BitCode;
+   Table = Nalloc((1<<Bit)*sizeof(int),"LZ77 long match table");
+   for (Slot = 0; Slot < (1 << Bit); Slot++) Table[Slot] = NONE;
+
+   LongMax  = 256;
+   Lz->Long = Nalloc(LongMax*sizeof(match),"LZ77 long matches");
+
+   for (Pow = 1, P = 1; P < LONG_HASH_LEN; P++) Pow *= LONG_PRIME;
+
+   Covered = Lz->Start; /* Matches don't overlap */
+
+   P    = 0;
+   Hash = LongHash(Text(Lz,0));
+
+   while (TRUE) {
+
+      Key = Hash * 2654435761U;
+
+      if ((Key >> (32 - LONG_ANCHOR)) == 0) {
+
+         Slot = (int) ((Key >> (32 - LONG_ANCHOR - Bit)) & ((1U << Bit) - 1));
+         Q    = Table[Slot];
+         Table[Slot] = P;
+
+         if (Q != NONE && P >= Covered) {
+
+            /* A match from the dictionary goes on in the block past the seam */
+
+            Max = Lz->N - P;
+            if (Q < Lz->Start && Q + Max > Lz->Start + LenMax) Max = Lz->Start + LenMax - Q;
+
+            Len = CommonLen(Text(Lz,P),Text(Lz,Q),Max);
+            if (Len == Max) Len += CommonLen(Text(Lz,P+Len),Text(Lz,Q+Len),Lz->N-P-Len);
+
+            for (Back = 0; P-Back > Covered && Q-Back > 0 && *Text(Lz,P-Back-1) == *Text(Lz,Q-Back-1); Back++)
+               ;
+
+            if (Len + Back >= LONG_LEN_MIN) {
+
+               if (Lz->LongNb == LongMax) {
+                  LongMax *= 2;
+                  Lz->Long = Realloc(Lz->Long,LongMax*sizeof(match));
+               }
+
+               Lz->Long[Lz->LongNb].Pos  = P - Back;
+               Lz->Long[Lz->LongNb].Len  = Len + Back;
+               Lz->Long[Lz->LongNb].Dist = P - Q;
+               Lz->LongNb++;
+
+               Covered = P + Len;
+               if (Covered > Lz->N - LONG_HASH_LEN) break;
+
+               P    = Covered;
+               Hash = LongHash(Text(Lz,P));
+               continue;
+            }
+         }
+      }
+
+      if (P >= Lz->N - LONG_HASH_LEN) break;
+
+      Hash = (Hash - *Text(Lz,P) * Pow) * LONG_PRIME + *Text(Lz,P+LONG_HASH_LEN);
+      P++;
+   }
+
+   Free(Table);
+
+   if (Lz->Verbosity >= 2) {
+      for (Len = 0, P = 0; P < Lz->LongNb; P++) Len += Lz->Long[P].Len;
+      fprintf(stderr,"%d long matches, %d bytes\n",Lz->LongNb,Len);
+      if (Lz->LongNb != 0) Lz->Verbosity = 1; /* Parsing goes in pieces from now on */
+   }
+}
+
+/* SendLong() */
+
+static void SendLong(lz77 *Lz, match *Long, int End) {
+
+   int Len, Stop;
+
+   /* Length-limited tokens at the same distance, which codes as a repeat */
+
+   Stop = Long->Pos + Long->Len;
+   if (Stop > End) Stop = End;
+
+   while (Lz->Pos < Stop) {
+      Len = Stop - Lz->Pos;
+      if (Len > LenMax) Len = LenMax;
+      if (Len >= LenMin) {
+         Lz->Length[Lz->SymbolNb]   = Len;
+         Lz->Distance[Lz->SymbolNb] = Long->Dist;
+      } else {
+         Len = 1;
+         Lz->Length[Lz->SymbolNb]   = 1;
+         Lz->Distance[Lz->SymbolNb] = *Text(Lz,Lz->Pos);
+      }
+      Lz->SymbolNb++;
+      Lz->Pos += Len;
+   }
+
+   Long->Len -= Lz->Pos - Long->Pos;
+   Long->Pos  = Lz->Pos;
+
+   /* Parsing resumes with the window just before, it's not worth hashing */
+   /* a long match whole                                                 */
+
+   Lz->NextLen  = 0;
+   Lz->LastDist = Long->Dist;
+
+   if (Lz->Pos - Lz->Hashed > LONG_REFILL) {
+      InitHash(Lz);
+      Lz->Hashed = Lz->Pos - LONG_REFILL;
+   }
+}
+
+/* LongHash() */
+
+static uint LongHash(const uchar *S) {
+
+   int I;
+   uint Hash;
+
+   for (Hash = 0, I = 0; I < LONG_HASH_LEN; I++) Hash = Hash * LONG_PRIME + S[I];
+
+   return Hash;
+}
+
+/* Text() */
+
+static const uchar *Text(const lz77 *Lz, int P) {
+
+   /* Positions below Start are the dictionary's, the seam holds LenMax */
+   /* bytes beyond it so that no shorter string has to be cut          */
+
+   return (P < Lz->Start) ? &Lz->Seam[P] : &Lz->S[P-Lz->Start];
+}
+
+/* FastLZ77() */
+
+static void FastLZ77(lz77 *Lz) {
+
+   int I, P, LastP, Hashed, Len, Dist, NextLen, NextDist;
+
+   LastP = 0;
+
+   if (Lz->Verbosity >= 2) {
+      LastP = 100 * Lz->Pos / Lz->N;
+      if (Lz->Pos == Lz->Start) {
+         fprintf(stderr,"Collecting strings ... %2d%%",LastP);
+         fflush(stderr);
+      }
+   }
+
+   I      = Lz->Pos;
+   Hashed = Lz->Hashed;
+   Len    = Lz->NextLen; /* 0 => no match searched yet at I */
+   Dist   = Lz->NextDist;
+
+   if (I == 0 && Lz->N > 0) {
+      Lz->Length[Lz->SymbolNb]   = 1;
+      Lz->Distance[Lz->SymbolNb] = *Text(Lz,0);
+      Lz->SymbolNb++;
+      I++;
+   }
+
+   while (I < Lz->End && I <= Lz->N-LenMin) {
+
+      if (Lz->Verbosity >= 2) {
+         P = 100 * I / Lz->N;
+         if (P != LastP) {
+            LastP = P;
+            fprintf(stderr,"\b\b\b%2d%%",LastP);
+            fflush(stderr);
+         }
+      }
+
+      for (; Hashed < I; Hashed++) SkipMatch(Lz,Hashed);
+
+      if (Len == 0) {
+         Len = FindMatch(Lz,I,&Dist);
+         Hashed++;
+      }
+
+      if (Len > Lz->Limit - I) Len = (Lz->Limit - I >= LenMin) ? Lz->Limit - I : 1;
+
+      /* Lazy evaluation: defer a short match if the next position has a longer one */
+
+      if (Len >= LenMin && Len < Lz->LazyLen && I+1 <= Lz->N-LenMin) {
+
+         NextLen = FindMatch(Lz,I+1,&NextDist);
+         Hashed++;
+
+         if (NextLen > Lz->Limit - (I+1)) NextLen = (Lz->Limit - (I+1) >= LenMin) ? Lz->Limit - (I+1) : 1;
+
+         if (NextLen > Len) {
+            Lz->Length[Lz->SymbolNb]   = 1;
+            Lz->Distance[Lz->SymbolNb] = *Text(Lz,I);
+            Lz->SymbolNb++;
+            I++;
+            Len  = NextLen;
+            Dist = NextDist;
+            continue;
+         }
+      }
+
+      Lz->Length[Lz->SymbolNb] = Len;
+      if (Len >= LenMin) {
+         Lz->Distance[Lz->SymbolNb] = Dist;
+      } else {
+         Lz->Distance[Lz->SymbolNb] = *Text(Lz,I);
+      }
+      Lz->SymbolNb++;
+
+      I  += Len;
+      Len = 0;
+   }
+
+   for (; I < Lz->End && I > Lz->N-LenMin; I++, Lz->SymbolNb++) {
+      Lz->Length[Lz->SymbolNb]   = 1;
+      Lz->Distance[Lz->SymbolNb] = *Text(Lz,I);
+   }
+
+   Lz->Pos      = I;
+   Lz->Hashed   = Hashed;
+   Lz->NextLen  = Len; /* Searched at the chunk end, kept for the next one */
+   Lz->NextDist = Dist;
+
+   if (Lz->Verbosity >= 2 && Lz->End == Lz->N) fprintf(stderr,"\b\b\bDone.\n");
+}
+
+/* ThreadLZ77() */
+
+static void ThreadLZ77(lz77 *Lz) {
+
+   int I, K, ThreadNb, SymbolNb, SegmentNb, SegmentSize, *SegmentSymbolNb;
+   worker *Worker;
+
+   /* Fixed-size segments, parsed independently and concatenated: output */
+   /* doesn't depend on the thread count. Each segment refills its own   */
+   /* match finder with the window before it, so only matches crossing  */
+   /* a segment end are lost. Chunks are whole segments                 */
+
+   SegmentSize = Lz->SegmentSize;
+   SegmentNb   = (Lz->End - Lz->Pos + SegmentSize - 1) / SegmentSize;
+
+   ThreadNb = Lz->ThreadNb;
+   if (ThreadNb > SegmentNb) ThreadNb = SegmentNb;
+
+   if (Lz->Verbosity >= 2) fprintf(stderr,"Collecting strings: %d segments of %d bytes, %d threads\n",SegmentNb,SegmentSize,ThreadNb);
+
+   SegmentSymbolNb = Nalloc(SegmentNb*sizeof(int),"LZ77 segment sizes");
+   Worker          = Nalloc(ThreadNb*sizeof(worker),"LZ77 workers");
+
+   for (I = 0; I < ThreadNb; I++) {
+      Worker[I].Main      = Lz;
+      Worker[I].First     = I;
+      Worker[I].Step      = ThreadNb;
+      Worker[I].SegmentNb = SegmentNb;
+      Worker[I].SymbolNb  = SegmentSymbolNb;
+      StartThread(Worker[I].Thread,&WorkLZ77,&Worker[I]);
+   }
+
+   for (I = 0; I < ThreadNb; I++) JoinThread(Worker[I].Thread);
+
+   InitHash(Lz); /* Filled by the first worker */
+
+   /* Stitch: a segment has at most as many tokens as bytes, so moving */
+   /* them down never overwrites tokens yet to be moved                */
+
+   SymbolNb = Lz->SymbolNb;
+
+   for (K = 0; K < SegmentNb; K++) {
+      memmove(&Lz->Length[SymbolNb],&Lz->Length[Lz->SymbolNb+K*SegmentSize],SegmentSymbolNb[K]*sizeof(ushort));
+      memmove(&Lz->Distance[SymbolNb],&Lz->Distance[Lz->SymbolNb+K*SegmentSize],SegmentSymbolNb[K]*sizeof(int));
+      SymbolNb += SegmentSymbolNb[K];
+   }
+
+   Lz->SymbolNb = SymbolNb;
+   Lz->Pos      = Lz->End;
+
+   Free(Worker);
+   Free(SegmentSymbolNb);
+}
+
+/* WorkLZ77() */
+
+static void WorkLZ77(void *Data) {
+
+   int K, Start, End, Size;
+   worker *Worker;
+   const lz77 *Main;
+   lz77 *Lz;
+
+   Worker = Data;
+   Main   = Worker->Main;
+   Lz     = Worker->Lz;
+
+   *Lz = *Main;
+
+   Lz->Verbosity = 0;
+
+   /* Tables index a segment and the window before it, with the same key */
+   /* size in all workers. The first one borrows the main tables, which  */
+   /* are idle until the threads are joined                              */
+
+   Size = Main->SegmentSize + Main->DistMax;
+   if (Size > Main->N) Size = Main->N;
+
+   if (Worker->First == 0) {
+      Lz->HashBit = HashBit(Size);
+   } else {
+      AllocHash(Lz,Size);
+   }
+
+   for (K = Worker->First; K < Worker->SegmentNb; K += Worker->Step) {
+
+      Start = Main->Pos + K * Main->SegmentSize;
+      End   = (Main->End - Start > Main->SegmentSize) ? Start + Main->SegmentSize : Main->End;
+
+      /* Matches stop at the segment end, tokens go where the segment starts */
+
+      RestartLZ77(Lz,Start);
+
+      Lz->N        = End;
+      Lz->End      = End;
+      Lz->Limit    = End;
+      Lz->Length   = &Main->Length[Main->SymbolNb+Start-Main->Pos];
+      Lz->Distance = &Main->Distance[Main->SymbolNb+Start-Main->Pos];
+      Lz->SymbolNb = 0;
+
+      FastLZ77(Lz);
+
+      Worker->SymbolNb[K] = Lz->SymbolNb;
+   }
+
+   if (Worker->First != 0) FreeHash(Lz);
+}
+
+/* SlowLZ77() */
+
+static void SlowLZ77(lz77 *Lz) {
+
+   int I, J, K, P, LastP, BestLen, BestDist, StringNb;
+   match *Match, M1[1], M2[1];
+
+   LastP = 0;
+
+   if (Lz->Verbosity >= 2) {
+      LastP = 0;
+      fprintf(stderr,"Collecting strings ... %2d%%",LastP);
+      fflush(stderr);
+   }
+
+   StringNb = 0;
+   InitHash(Lz);
+
+   if (Lz->N > 0) Lz->Length[0] = 1;
+   if (Lz->N >= LenMin) SkipMatch(Lz,0);
+
+   for (I = 1; I <= Lz->N-LenMin; I++) {
+
+      if (Lz->Verbosity >= 2) {
+         P = 100 * I / Lz->N;
+         if (P != LastP) {
+            LastP = P;
+            fprintf(stderr,"\b\b\b%2d%%",LastP);
+            fflush(stderr);
+         }
+      }
+
+      BestDist = 0;
+      BestLen  = FindMatch(Lz,I,&BestDist);
+
+      if (BestLen >= LenMin) {
+         Lz->Length[I]   = BestLen;
+         Lz->Distance[I] = BestDist;
+         StringNb++;
+      } else {
+         Lz->Length[I] = 1;
+      }
+   }
+
+   while (I < Lz->N) Lz->Length[I++] = 1;
+
+   if (Lz->Verbosity >= 2) fprintf(stderr,"\b\b\bDone.\n");
+
+   Match = Nalloc(StringNb*sizeof(match),"LZ77 match array");
+
+   for (I = 0, J = 0; I < Lz->N; I++) if (Lz->Length[I] >= LenMin) GetMatch(Lz,&Match[J++],I);
+
+   if (Lz->Verbosity >= 2) {
+      fprintf(stderr,"Sorting matches    ... ");
+      fflush(stderr);
+   }
+
+   qsort(Match,(size_t)StringNb,sizeof(match),&MatchCmp);
+
+   if (Lz->Verbosity >= 2) {
+
+      fprintf(stderr,"Done.\n");
+
+      fprintf(stderr,"Selecting matches  ... ");
+      fflush(stderr);
+   }
+
+   for (I = 0; I < StringNb; I++) {
+      J = Match[I].Pos;
+      if (Lz->Length[J] >= LenMin) {
+         for (K = J+1; K < J+Lz->Length[J]; K++) {
+            GetMatch(Lz,M1,J);
+            GetMatch(Lz,M2,K);
+            if (Lz->Length[K] >= Lz->Length[J] && MatchCmp(M1,M2) > 0) {
+	       Lz->Length[J] = K - J;
+               break;
+            }
+            Lz->Length[K] = 1;
+         }
+      }
+   }
+
+   if (Lz->Verbosity >= 2) fprintf(stderr,"Done.\n");
+
+   Free(Match);
+
+   for (I = 0, J = 0; I < Lz->N; J++) {
+      if (Lz->Length[I] >= LenMin) {
+         Lz->Length[J]   = Lz->Length[I];
+         Lz->Distance[J] = Lz->Distance[I];
+         I += Lz->Length[I];
+      } else {
+         Lz->Length[J]   = 1;
+         Lz->Distance[J] = *Text(Lz,I);
+         I++;
+      }
+   }
+
+   Lz->SymbolNb = J;
+}
+
+/* BestLZ77() */
+
+static void BestLZ77(lz77 *Lz) {
+
+   int I, J, K, P, LastP, Start, End, Size, SkipTo, Pass, MatchNb, MatchMax;
+   int Len, MaxLen, PrevLen, Dist, LastDist, Price, Cost, TokenNb;
+   int *MatchStart, *TokenLen, *TokenDist, DistCode, LenCode[259+1];
+   int PassFreq[SYMBOL_NB], SymCost[SYMBOL_NB];
+   match *Match;
+   opt_node *Node;
+   huftable HufTable[1];
+
+   /* Shortest path parse: every candidate match (one per length, as     */
+   /* found by the binary tree) is an edge priced in bits by the current  */
+   /* huffman code lengths plus Info[] extra bits. Code lengths are taken  */
+   /* from the symbols chosen so far, and refined by parsing each chunk    */
+   /* OPT_PASS times.                                                      */
+
+   LastP = 0;
+
+   if (Lz->Verbosity >= 2) {
+      LastP = 100 * Lz->Pos / Lz->N;
+      if (Lz->Pos == Lz->Start) {
+         fprintf(stderr,"Parsing strings    ... %2d%%",LastP);
+         fflush(stderr);
+      }
+   }
+
+   MatchMax   = 4 * (OPT_CHUNK + 259);
+   Match      = Nalloc(MatchMax*sizeof(match),"LZ77 match array");
+   MatchStart = Nalloc((OPT_CHUNK+259+1)*sizeof(int),"LZ77 match index");
+   Node       = Nalloc((OPT_CHUNK+259+1)*sizeof(opt_node),"LZ77 parse array");
+   TokenLen   = Nalloc((OPT_CHUNK+259)*sizeof(int),"LZ77 token array");
+   TokenDist  = Nalloc((OPT_CHUNK+259)*sizeof(int),"LZ77 token array");
+
+   for (I = 0; I <= LenMax-LenMin; I++) LenCode[I] = BitCode(I);
+
+   AllocHufTable(HufTable,Lz->CodeNb,LEN_MAX,FORMAT);
+
+   PriceSymbols(SymCost,Lz->Freq,HufTable); /* As left by the previous chunk */
+
+   for (; Lz->Hashed < Lz->Pos && Lz->Hashed <= Lz->N-LenMin; Lz->Hashed++) SkipMatch(Lz,Lz->Hashed); /* Dictionary */
+
+   LastDist = Lz->LastDist;
+   SkipTo   = Lz->SkipTo;
+
+   for (Start = Lz->Pos; Start < Lz->End; Start = End) {
+
+      if (Lz->Verbosity >= 2) {
+         P = 100 * Start / Lz->N;
+         if (P != LastP) {
+            LastP = P;
+            fprintf(stderr,"\b\b\b%2d%%",LastP);
+            fflush(stderr);
+         }
+      }
+
+      /* Candidate matches; a chunk never ends inside a skipped long match */
+
+      MatchNb = 0;
+
+      for (I = Start; I < Lz->Limit && (I < Start + OPT_CHUNK || I < SkipTo); I++) {
+
+         MatchStart[I-Start] = MatchNb;
+
+         if (I > Lz->N-LenMin) continue;
+
+         if (I < SkipTo) {
+            SkipMatch(Lz,I);
+            continue;
+         }
+
+         if (MatchNb + 259 > MatchMax) {
+            MatchMax *= 2;
+            Match     = Realloc(Match,MatchMax*sizeof(match));
+         }
+
+         K = TreeMatch(Lz,I,&Match[MatchNb]);
+         MatchNb += K;
+
+         if (K != 0 && Match[MatchNb-1].Len >= Lz->GoodLen) SkipTo = I + Match[MatchNb-1].Len;
+      }
+
+      End  = I;
+      Size = End - Start;
+
+      MatchStart[Size] = MatchNb;
+
+      for (Pass = 0; Pass < OPT_PASS; Pass++) {
+
+         Node[0].Price    = 0;
+         Node[0].LastDist = LastDist;
+         for (J = 1; J <= Size; J++) Node[J].Price = OPT_INFINITY;
+
+         for (J = 0; J < Size; J++) {
+
+            I = Start + J;
+
+            /* Literal */
+
+            Price = Node[J].Price + SymCost[*Text(Lz,I)];
+            if (Price < Node[J+1].Price) {
+               Node[J+1].Price    = Price;
+               Node[J+1].Len      = 1;
+               Node[J+1].Dist     = 0;
+               Node[J+1].LastDist = Node[J].LastDist;
+            }
+
+            /* Repeat distance, coded as distance 0 */
+
+            Dist = Node[J].LastDist;
+
+            if (I >= Dist) {
+
+               MaxLen = Size - J;
+               if (MaxLen > LenMax) MaxLen = LenMax;
+
+               Len = CommonLen(Text(Lz,I),Text(Lz,I-Dist),MaxLen);
+
+               for (K = LenMin; K <= Len; K++) {
+                  Cost  = SymCost[0x100+(LenCode[K-LenMin]<<Lz->DistBit)];
+                  Cost += (K == LenMax) ? 0 : Info[LenCode[K-LenMin]].Len;
+                  Price = Node[J].Price + Cost;
+                  if (Price < Node[J+K].Price) {
+                     Node[J+K].Price    = Price;
+                     Node[J+K].Len      = K;
+                     Node[J+K].Dist     = Dist;
+                     Node[J+K].LastDist = Dist;
+                  }
+               }
+            }
+
+            /* Matches, each one covers the lengths above the previous one */
+
+            PrevLen = LenMin - 1;
+
+            for (P = MatchStart[J]; P < MatchStart[J+1]; P++) {
+
+               Dist = Match[P].Dist;
+
+               MaxLen = Match[P].Len;
+               if (MaxLen > Size - J) MaxLen = Size - J;
+
+               K = (Dist == Node[J].LastDist) ? 0 : Dist;
+               DistCode = BitCode(K);
+
+               for (Len = PrevLen + 1; Len <= MaxLen; Len++) {
+                  Cost  = SymCost[0x100+((LenCode[Len-LenMin]<<Lz->DistBit)|DistCode)];
+                  Cost += (Len == LenMax) ? 0 : Info[LenCode[Len-LenMin]].Len;
+                  Cost += Info[DistCode].Len;
+                  Price = Node[J].Price + Cost;
+                  if (Price < Node[J+Len].Price) {
+                     Node[J+Len].Price    = Price;
+                     Node[J+Len].Len      = Len;
+                     Node[J+Len].Dist     = Dist;
+                     Node[J+Len].LastDist = Dist;
+                  }
+               }
+
+               if (MaxLen > PrevLen) PrevLen = MaxLen;
+            }
+         }
+
+         /* Backtrack, tokens are stored from the end of the arrays */
+
+         TokenNb = 0;
+
+         for (J = Size; J > 0; J -= Node[J].Len) {
+            TokenNb++;
+            TokenLen[OPT_CHUNK+259-TokenNb]  = Node[J].Len;
+            TokenDist[OPT_CHUNK+259-TokenNb] = Node[J].Dist;
+         }
+
+         for (I = 0; I < Lz->CodeNb; I++) PassFreq[I] = Lz->Freq[I];
+         CountSymbols(Lz,PassFreq,Start,&TokenLen[OPT_CHUNK+259-TokenNb],&TokenDist[OPT_CHUNK+259-TokenNb],TokenNb,LastDist);
+
+         if (Pass == OPT_PASS-1) {
+            for (I = 0; I < Lz->CodeNb; I++) Lz->Freq[I] = PassFreq[I];
+         }
+
+         PriceSymbols(SymCost,PassFreq,HufTable);
+      }
+
+      for (I = Start, J = OPT_CHUNK+259-TokenNb; J < OPT_CHUNK+259; J++, Lz->SymbolNb++) {
+         Lz->Length[Lz->SymbolNb] = TokenLen[J];
+         if (TokenLen[J] >= LenMin) {
+            Lz->Distance[Lz->SymbolNb] = TokenDist[J];
+         } else {
+            Lz->Distance[Lz->SymbolNb] = *Text(Lz,I);
+         }
+         I += TokenLen[J];
+      }
+
+      LastDist = Node[Size].LastDist;
+   }
+
+   Lz->Pos      = Start;
+   Lz->Hashed   = Start;
+   Lz->LastDist = LastDist;
+   Lz->SkipTo   = SkipTo;
+
+   FreeHufTable(HufTable);
+
+   Free(TokenDist);
+   Free(TokenLen);
+   Free(Node);
+   Free(MatchStart);
+   Free(Match);
+
+   if (Lz->Verbosity >= 2 && Lz->End == Lz->N) fprintf(stderr,"\b\b\bDone.\n");
+}
+
+/* PriceSymbols() */
+
+static void PriceSymbols(int Cost[], const int Freq[], huftable *HufTable) {
+
+   int I, Smooth[SYMBOL_NB];
+
+   /* Unseen symbols still get a (long) code */
+
+   for (I = 0; I < HufTable->N; I++) Smooth[I] = 2 * Freq[I] + 1;
+
+   CompLens(HufTable,Smooth);
+
+   for (I = 0; I < HufTable->N; I++) Cost[I] = HufTable->HufSym[I].Len;
+}
+
+/* CountSymbols() */
+
+static void CountSymbols(const lz77 *Lz, int Freq[], int P, const int Len[], const int Dist[], int TokenNb, int LastDist) {
+
+   int I, D, Code;
+
+   /* Same symbols as CodeLZ77() */
+
+   for (I = 0; I < TokenNb; P += Len[I++]) {
+      if (Len[I] >= LenMin) {
+         D = Dist[I];
+         if (D == LastDist) {
+            D = 0;
+         } else {
+            LastDist = D;
+         }
+         Code = 0x100 + ((BitCode(Len[I]-LenMin) << Lz->DistBit) | BitCode(D));
+      } else {
+         Code = *Text(Lz,P);
+      }
+      Freq[Code]++;
+   }
+}
+
+/* HashKey() */
+
+static int HashKey(const lz77 *Lz, int P) {
+
+   uint Key;
+   const uchar *S;
+
+   S   = Text(Lz,P);
+   Key = ((uint)S[0] << 16) | ((uint)S[1] << 8) | (uint)S[2];
+
+   return (int)(((Key * 2654435761U) & 0xFFFFFFFFU) >> (32 - Lz->HashBit)); /* Fibonacci hashing */
+}
+
+/* InitHash() */
+
+static void InitHash(lz77 *Lz) {
+
+   int I;
+
+   /* Only the heads are cleared, window slots are trusted when within DistMax */
+
+   for (I = 0; I < (1 << Lz->HashBit); I++) Lz->HashHead[I] = NONE;
+}
+
+/* AddHash() */
+
+static void AddHash(lz77 *Lz, int P) {
+
+   int Key;
+
+   Key = HashKey(Lz,P);
+
+   Lz->HashNext[P&Lz->WindowMask] = Lz->HashHead[Key];
+   Lz->HashHead[Key] = P;
+}
+
+/* FindMatch() */
+
+static int FindMatch(lz77 *Lz, int P, int *Dist) {
+
+   int MatchNb;
+
+   /* Searches the window for P, then adds P to it */
+
+   if (! Lz->Tree) return ChainMatch(Lz,P,Dist);
+
+   MatchNb = TreeMatch(Lz,P,Lz->Match);
+   if (MatchNb == 0) return 1;
+
+   *Dist = Lz->Match[MatchNb-1].Dist;
+
+   return Lz->Match[MatchNb-1].Len;
+}
+
+/* SkipMatch() */
+
+static void SkipMatch(lz77 *Lz, int P) {
+
+   if (Lz->Tree) {
+      TreeMatch(Lz,P,NULL);
+   } else {
+      AddHash(Lz,P);
+   }
+}
+
+/* ChainMatch() */
+
+static int ChainMatch(lz77 *Lz, int P, int *Dist) {
+
+   int K, Key, Len, Max, BestLen, Chain;
+   const uchar *SP;
+
+   BestLen = 1;
+
+   Chain = Lz->ChainMax;
+
+   /* Hash keys may collide, so the first 3 bytes are compared as well */
+
+   SP  = Text(Lz,P);
+   Max = Lz->N - P;
+   if (Max > LenMax) Max = LenMax;
+
+   /* Positions go down the chain, the first one out of the window ends it */
+
+   Key = HashKey(Lz,P);
+
+   for (K = Lz->HashHead[Key]; K != NONE && P - K <= Lz->DistMax && Chain-- > 0; K = Lz->HashNext[K&Lz->WindowMask]) {
+      Len = CommonLen(Text(Lz,K),SP,Max);
+      if (Len >= LenMin && Len > BestLen) {
+         BestLen = Len;
+         *Dist   = P - K;
+         if (Len >= Lz->GoodLen) break;
+      }
+   }
+
+   Lz->HashNext[P&Lz->WindowMask] = Lz->HashHead[Key]; /* AddHash() */
+   Lz->HashHead[Key] = P;
+
+   return BestLen;
+}
+
+/* TreeMatch() */
+
+static int TreeMatch(lz77 *Lz, int P, match *Match) {
+
+   int Key, K, Len, Len0, Len1, LenLimit, BestLen, MatchNb, Chain;
+   int *Son, *Smaller, *Greater, *Pair;
+   const uchar *SP, *SK;
+
+   /* Each hash key roots a binary tree of the window positions, ordered by */
+   /* suffix. Inserting P at the root walks down the path where P's suffix  */
+   /* would be, splitting the tree on both sides and meeting the longest    */
+   /* matches on the way. Match[] gets the closest match of each length.    */
+
+   SP  = Text(Lz,P);
+   Son = Lz->TreeSon;
+
+   LenLimit = Lz->N - P;
+   if (LenLimit > LenMax) LenLimit = LenMax;
+
+   Key = HashKey(Lz,P);
+   K   = Lz->HashHead[Key];
+   Lz->HashHead[Key] = P;
+
+   Smaller = &Son[2*(P&Lz->WindowMask)];   /* [0] = smaller suffixes */
+   Greater = &Son[2*(P&Lz->WindowMask)+1]; /* [1] = greater suffixes */
+
+   Len0 = 0;
+   Len1 = 0;
+
+   BestLen = LenMin - 1;
+   MatchNb = 0;
+
+   Chain = Lz->ChainMax;
+
+   while (TRUE) {
+
+      if (K == NONE || P - K > Lz->DistMax || Chain-- == 0) {
+         *Smaller = -1;
+         *Greater = -1;
+         break;
+      }
+
+      Pair = &Son[2*(K&Lz->WindowMask)];
+      SK   = Text(Lz,K);
+
+      Len = (Len0 < Len1) ? Len0 : Len1;
+      Len += CommonLen(&SK[Len],&SP[Len],LenLimit-Len);
+
+      if (Len > BestLen) {
+         BestLen = Len;
+         if (Match != NULL) {
+            Match[MatchNb].Pos  = P;
+            Match[MatchNb].Len  = Len;
+            Match[MatchNb].Dist = P - K;
+            MatchNb++;
+         }
+         if (Len >= LenLimit) { /* K is replaced by P */
+            *Smaller = Pair[0];
+            *Greater = Pair[1];
+            break;
+         }
+      }
+
+      if (Len < LenLimit && SK[Len] < SP[Len]) {
+         *Smaller = K;
+         Smaller  = &Pair[1];
+         K        = *Smaller;
+         Len1     = Len;
+      } else {
+         *Greater = K;
+         Greater  = &Pair[0];
+         K        = *Greater;
+         Len0     = Len;
+      }
+   }
+
+   return MatchNb;
+}
+
+/* CommonLen() */
+
+static int CommonLen(const uchar *S1, const uchar *S2, int Max) {
+
+   int Len;
+   uint64 W1, W2, Diff;
+
+   /* Eight bytes at a time: the first differing byte is the lowest (little */
+   /* endian) or highest (big endian) non-zero byte of the XOR              */
+
+   for (Len = 0; Len + 8 <= Max; Len += 8) {
+
+      memcpy(&W1,S1+Len,8);
+      memcpy(&W2,S2+Len,8);
+
+      Diff = W1 ^ W2;
+
+      if (Diff != 0) {
+#if defined __GNUC__ && defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+         return Len + (__builtin_ctzll(Diff) >> 3);
+#elif defined __GNUC__ && defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+         return Len + (__builtin_clzll(Diff) >> 3);
+#else
+         break; /* Found bytewise below */
+#endif
+      }
+   }
+
+   while (Len < Max && S1[Len] == S2[Len]) Len++;
+
+   return Len;
+}
+
+/* GetMatch() */
+
+static void GetMatch(const lz77 *Lz, match *Match, int P) {
+
+   Match->Pos  = P;
+   Match->Len  = Lz->Length[P];
+   Match->Dist = Lz->Distance[P];
+}
+
+/* MatchCmp() */
+
+static int MatchCmp(const void *M1, const void *M2) {
+
+   const match *Match1, *Match2;
+
+   Match1 = M1;
+   Match2 = M2;
+
+   if (Match1->Len != Match2->Len) return Match2->Len - Match1->Len;
+
+   if (Match1->Dist != Match2->Dist) return Match1->Dist - Match2->Dist;
+
+   return Match1->Pos - Match2->Pos;
+}
+
+/* BitCode() */
+
+static int BitCode(int N) {
+
+   int BitCode;
+
+   for (BitCode = 0; BitCode < INFO_NB-1 && N >= Info[BitCode+1].Start; BitCode++)
+      ;
+
+   return BitCode;
+}
+
+/* InitTokens() */
+
+static void InitTokens(token Token[], int N, int DistBit) {
+
+   int Symbol, Code, LenCode, DistCode;
+   token *T;
+
+   for (Symbol = 0; Symbol < N; Symbol++) {
+
+      T = &Token[Symbol];
+
+      T->Bits = 0;
+
+      if (Symbol < 0x100) {
+         T->Len     = 0;
+         T->Dist    = Symbol;
+         T->LenLen  = 0;
+         T->DistLen = 0;
+      } else {
+         Code     = Symbol - 0x100;
+         LenCode  = Code >> DistBit;
+         DistCode = Code & ((1 << DistBit) - 1);
+         if (LenCode < 16) {
+            T->Len    = Info[LenCode].Start + LenMin;
+            T->LenLen = Info[LenCode].Len;
+         } else {
+            T->Len    = LenMax;
+            T->LenLen = 0;
+         }
+         T->Dist    = Info[DistCode].Start; /* + 1 */
+         T->DistLen = Info[DistCode].Len;
+      }
+   }
+}
+
+/* CompTokens() */
+
+static void CompTokens(token Fast[], const token Token[], const huftable *HufTable) {
+
+   int Symbol, Len, I, First, Last;
+   const hufsym *HufSym;
+
+   for (I = 0; I < 1 << TOKEN_BIT; I++) Fast[I].Bits = 0;
+
+   /* A code of Len bits fills every entry it prefixes */
+
+   for (Symbol = 0; Symbol < HufTable->N; Symbol++) {
+
+      HufSym = &HufTable->HufSym[Symbol];
+      Len    = HufSym->Len;
+
+      if (Len != 0 && Len <= TOKEN_BIT) {
+         First = HufSym->Code << (TOKEN_BIT - Len);
+         Last  = First + (1 << (TOKEN_BIT - Len));
+         for (I = First; I < Last; I++) {
+            Fast[I]      = Token[Symbol];
+            Fast[I].Bits = Len + Token[Symbol].LenLen;
+         }
+      }
+   }
+}
+
+/* CopyMatch() */
+
+static uchar *CopyMatch(uchar *Dst, int Dist, int Len, const uchar *End) {
+
+   const uchar *Src;
+   uchar *Stop;
+   int I;
+
+   Src  = Dst - Dist;
+   Stop = Dst + Len;
+
+   if (End - Stop < COPY_SLACK) { /* No room to overshoot */
+      do *Dst++ = *Src++; while (Dst < Stop);
+      return Stop;
+   }
+
+   if (Dist < 8) {
+
+      if (Dist == 1) {
+         memset(Dst,*Src,(size_t)Len);
+         return Stop;
+      }
+
+      /* Lay down the first 8 bytes, then copy from a whole number of */
+      /* periods back so that 8-byte chunks no longer overlap          */
+
+      for (I = 0; I < 8; I++) Dst[I] = Src[I];
+
+      Dst += 8;
+      Src  = Dst - Period[Dist];
+      if (Dst >= Stop) return Stop;
+   }
+
+   do {
+      memcpy(Dst,Src,8);
+      memcpy(Dst+8,Src+8,8);
+      Dst += 16;
+      Src += 16;
+   } while (Dst < Stop);
+
+   return Stop;
+}
+
+/* FlushLZ77() */
+
+static void FlushLZ77(codec *Codec, const uchar *Block, int Size, uchar *Temp) {
+
+   int I, Delta;
+   const uchar *Data;
+
+   /* Temp starts with the last DELTA_MAX bytes sent (0 at first) */
+
+   Data  = Block;
+   Delta = Codec->Delta;
+
+   if (Delta != 0) {
+      for (I = 0; I < Size; I++) Temp[DELTA_MAX+I] = Block[I] + Temp[DELTA_MAX+I-Delta];
+      Data = &Temp[DELTA_MAX];
+   }
+
+   Codec->Crc = UpdateCRC(Codec->Crc,Data,Size);
+   if (Codec->Out != NULL) SendBlock(Codec->Out,Data,Size);
+
+   if (Delta != 0) memmove(Temp,&Temp[Size],DELTA_MAX);
+}
+
+/* SendFast() */
+
+static int SendFast(const lz77 *Lz, uchar *Buffer, int Pos) {
+
+   int I, Len, Lit, LitPos;
+   uchar *Out, *Token;
+
+   /* Sequences: token (literal run << 4 | match length - FAST_LEN_MIN), */
+   /* literals, 16-bit little-endian distance; a final sequence may     */
+   /* stop after its literals                                          */
+
+   Out    = Buffer;
+   LitPos = Pos;
+
+   for (I = 0; I < Lz->SymbolNb; I++) {
+
+      Len = Lz->Length[I];
+
+      if (Len < FAST_LEN_MIN) { /* Literal, or a match not worth it */
+         Pos += Len;
+         continue;
+      }
+
+      Lit   = Pos - LitPos;
+      Token = Out++;
+      *Token = (uchar) (((Lit < FAST_RUN) ? Lit : FAST_RUN) << 4);
+      if (Lit >= FAST_RUN) Out = SendRun(Out,Lit-FAST_RUN);
+      memcpy(Out,Text(Lz,LitPos),(size_t)Lit);
+      Out += Lit;
+
+      assert(Lz->Distance[I]>0&&Lz->Distance[I]<=65535);
+
+      *Out++ = (uchar) (Lz->Distance[I] & 0xFF);
+      *Out++ = (uchar) (Lz->Distance[I] >> 8);
+
+      Len -= FAST_LEN_MIN;
+      *Token |= (uchar) ((Len < FAST_RUN) ? Len : FAST_RUN);
+      if (Len >= FAST_RUN) Out = SendRun(Out,Len-FAST_RUN);
+
+      Pos   += Lz->Length[I];
+      LitPos = Pos;
+   }
+
+   if (Pos > LitPos) {
+      Lit  = Pos - LitPos;
+      *Out++ = (uchar) (((Lit < FAST_RUN) ? Lit : FAST_RUN) << 4);
+      if (Lit >= FAST_RUN) Out = SendRun(Out,Lit-FAST_RUN);
+      memcpy(Out,Text(Lz,LitPos),(size_t)Lit);
+      Out += Lit;
+   }
+
+   return Out - Buffer;
+}
+
+/* SendRun() */
+
+static uchar *SendRun(uchar *Out, int Run) {
+
+   for (; Run >= 255; Run -= 255) *Out++ = 255;
+   *Out++ = (uchar) Run;
+
+   return Out;
 }
 
 /* End of LZ77.C */
@@ -4,10 +4,15 @@
 #ifndef LZ77_H
 #define LZ77_H
 
+#include "algo.h"
+
 /* Prototypes */
 
-extern void CodeLZ77   (void);
-extern void DecodeLZ77 (void);
+extern void CodeLZ77   (codec *Codec);
+extern void DecodeLZ77 (codec *Codec);
+
+extern void CodeFast   (codec *Codec);
+extern void DecodeFast (codec *Codec);
 
 #endif /* ! defined LZ77_H */
 
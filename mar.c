@@ -1,6 +1,7 @@
 
 /* MAr.C */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,10 +16,13 @@
 #include "crc.h"
 #include "debug.h"
 #include "delta.h"
+#include "dict.h"
 
 /* Variables */
 
 static char *Program;
+static FILE *Log;               /* File names, stderr when the archive goes to stdout */
+static const char *InputName;   /* Name stored for a member read from stdin */
 
 /* Prototypes */
 
@@ -28,11 +32,15 @@ static void DeleteArchive  (const char *ArchiveName, const char **PatternList);
 static void ListArchive    (const char *ArchiveName, const char **PatternList);
 static void TestArchive    (const char *ArchiveName, const char **PatternList);
 static void ExtractArchive (const char *ArchiveName, const char **PatternList);
+static void MakeDict       (const char *DictName, const char **FileList);
 
-static void AddFile        (stream *Arc, const char *FileName);
+static void AddDict        (codec *Codec, stream *Arc);
+static void AddFile        (codec *Codec, stream *Arc, const char *FileName);
 static void TestFile       (archive *Archive);
 static void SaveFile       (archive *Archive);
 
+static const char *StdName (const char *Name);
+
 static int  MatchList      (const char *String, const char **PatternList);
 static int  Match          (const char *String, const char *Pattern);
 
@@ -43,53 +51,81 @@ static int  Match          (const char *String, const char *Pattern);
 int main(int argc, char *argv[]) {
 
    char *C;
-   const char *Command, *ArchiveName, **PatternList;
-   stream *Arc;
+   const char *Command, *ArchiveName, *DictName, **PatternList;
+   archive *Archive;
+   stream Arc[1];
+   codec Codec[1];
 
-   Program     = *argv++;
+   Program = *argv++;
 
-   Algorithm   = ALGO_LZH;
+   InitCodec(Codec);
 
-   Delta       = 0;     /* Delta */
-   Group       = FALSE; /* Huffman tree grouping */
-   Order       = 3;     /* PPM Order */
-   Verbosity   = 0;
+   Log       = stdout;
+   InputName = "stdin";
+   DictName  = NULL;
 
 /* Options */
 
    for (; *argv != NULL && (*argv)[0] == '-'; argv++) {
       switch ((*argv)[1]) {
+      case '1' : case '2' : case '3' : case '4' : case '5' :
+      case '6' : case '7' : case '8' : case '9' : /* Level */
+         Codec->Level = (*argv)[1] - '0';
+         break;
       case 'a' : /* Algorithm */
          argv++;
          if (*argv != NULL) {
 	    for (C = *argv; *C != '\0'; C++) *C = toupper(*C);
-	    Algorithm = AlgorithmNo(*argv);
-	    if (Algorithm < 0) Usage();
+	    Codec->Algorithm = AlgorithmNo(*argv);
+	    if (Codec->Algorithm < 0) Usage();
          }
          break;
+      case 'D' : /* Dictionary */
+         argv++;
+         if (*argv == NULL) Usage();
+         DictName = *argv;
+         break;
       case 'g' : /* Group */
-         Group = TRUE;
+         Codec->Group = TRUE;
+         break;
+      case 'j' : /* Threads */
+         argv++;
+         if (*argv == NULL || atoi(*argv) < 1 || atoi(*argv) > THREAD_MAX) Usage();
+         Codec->Threads = atoi(*argv);
+         break;
+      case 'l' : /* Long matches */
+         Codec->Long = TRUE;
+         break;
+      case 'n' : /* Name of standard input */
+         argv++;
+         if (*argv == NULL) Usage();
+         InputName = *argv;
          break;
       case 'o' : /* Order */
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Order = atoi(*argv);
+            Codec->Order = atoi(*argv);
          }
          break;
       case 't' : /* Delta */
-	 Delta = -1;
+	 Codec->Delta = -1;
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Delta = atoi(*argv);
+            Codec->Delta = atoi(*argv);
          }
          break;
       case 'v' : /* Verbosity */
-         Verbosity = 1;
+         Codec->Verbosity = 1;
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Verbosity = atoi(*argv);
+            Codec->Verbosity = atoi(*argv);
          }
          break;
+      case 'w' : /* Window */
+         argv++;
+         if (*argv == NULL || atoi(*argv) < WINDOW_MIN || atoi(*argv) > WINDOW_MAX) Usage();
+         Codec->Window = atoi(*argv);
+         break;
       default :
 	 Usage();
 	 break;
@@ -106,7 +142,7 @@ int main(int argc, char *argv[]) {
 
    PatternList = (const char **) argv;
 
-   if (Verbosity >= 1) fprintf(stderr,MAR_NAME "\n");
+   if (Codec->Verbosity >= 1) fprintf(stderr,MAR_NAME "\n");
 
 /* Command */
 
@@ -116,13 +152,26 @@ int main(int argc, char *argv[]) {
 
       if (*PatternList == NULL) Usage();
 
-      AppendOutStream(ArchiveName);
-      Arc = OutStream;
+      Archive = OpenArchive(ArchiveName);
+      if (Archive == NULL) {
+         fprintf(stderr,"missing or corrupt archive \"%s\"",ArchiveName);
+         exit(EXIT_FAILURE);
+      }
+      if (DictName != NULL) FatalError("the dictionary of \"%s\" can't be changed",ArchiveName);
+      Codec->Version  = Archive->Version; /* Keep the archive format */
+      Codec->Dict     = Archive->Dict;    /* and its dictionary */
+      Codec->DictSize = Archive->DictSize;
+      Archive->Dict   = NULL;
+      CloseArchive(Archive);
+
+      AppendOutStream(Arc,ArchiveName);
       for (; *PatternList != NULL; PatternList++) {
-	 printf("%s\n",*PatternList);
-	 AddFile(Arc,*PatternList);
+	 fprintf(Log,"%s\n",*PatternList);
+	 AddFile(Codec,Arc,*PatternList);
       }
-      CloseOutStream();
+      CloseStream(Arc);
+
+      FreeDict(Codec);
 
       break;
 
@@ -130,17 +179,25 @@ int main(int argc, char *argv[]) {
 
       if (*PatternList == NULL) Usage();
 
-      OpenOutStream(ArchiveName);
-      SendUInt8('M');
-      SendUInt8('A');
-      SendUInt8('r');
-      SendUInt8('0'+MAR_VERSION);
-      Arc = OutStream;
+      Codec->Version = MAR_VERSION;
+      if (DictName != NULL) LoadDict(Codec,DictName);
+
+      /* Members for a pipe are built in memory, names go to standard error */
+
+      OpenOutStream(Arc,StdName(ArchiveName));
+      if (! SeekableStream(Arc)) Log = stderr;
+      SendUInt8(Arc,'M');
+      SendUInt8(Arc,'A');
+      SendUInt8(Arc,'r');
+      SendUInt8(Arc,'0'+MAR_VERSION);
+      if (Codec->Dict != NULL) AddDict(Codec,Arc);
       for (; *PatternList != NULL; PatternList++) {
-	 printf("%s\n",*PatternList);
-	 AddFile(Arc,*PatternList);
+	 fprintf(Log,"%s\n",*PatternList);
+	 AddFile(Codec,Arc,*PatternList);
       }
-      CloseOutStream();
+      CloseStream(Arc);
+
+      FreeDict(Codec);
 
       break;
 
@@ -154,6 +211,13 @@ int main(int argc, char *argv[]) {
       ListArchive(ArchiveName,PatternList);
       break;
 
+   case 'M' : /* Make dictionary */
+
+      if (*PatternList == NULL) Usage();
+
+      MakeDict(ArchiveName,PatternList);
+      break;
+
    case 'T' : /* Test */
 
       TestArchive(ArchiveName,PatternList);
@@ -179,8 +243,10 @@ static void Usage(void) {
 
    fprintf(stderr,"Usage: %s [<options>] <command> <archive> [<files>]\n",Program);
    fprintf(stderr,"       <command>   = (a)dd | (c)reate | (d)elete | (l)ist | (t)est | e(x)tract all\n");
-   fprintf(stderr,"       <option>    = -a <algorithm> | -g | -o <order> | -t [<delta>] | -v [<level>]\n");
-   fprintf(stderr,"       <algorithm> = store | lzh | bwt | ppm\n");
+   fprintf(stderr,"                     | (m)ake dictionary, <archive> is then the dictionary file\n");
+   fprintf(stderr,"       <option>    = -1..-9 | -a <algorithm> | -D <dictionary> | -g | -j <threads> | -l | -n <name> | -o <order> | -t [<delta>] | -v [<level>] | -w <window>\n");
+   fprintf(stderr,"       <algorithm> = store | fast | lzh | lzx | bwt | ppm\n");
+   fprintf(stderr,"       \"-\" as <archive> or <file> means standard output/input\n");
 
    exit(EXIT_FAILURE);
 }
@@ -192,6 +258,7 @@ static void DeleteArchive(const char *ArchiveName, const char **PatternList) {
    archive *Archive;
    FILE *NewArc;
    void *Block;
+   int Size;
    char NewArcName[1024];
 
    assert(ArchiveName!=NULL);
@@ -208,7 +275,16 @@ static void DeleteArchive(const char *ArchiveName, const char **PatternList) {
    fputc('M',NewArc);
    fputc('A',NewArc);
    fputc('r',NewArc);
-   fputc('0'+MAR_VERSION,NewArc);
+   fputc('0'+Archive->Version,NewArc);
+
+   if (Archive->Dict != NULL) { /* Dictionary member, ahead of the first file */
+      Size  = Archive->Pos - 4;
+      Block = Nalloc(Size,"Dictionary");
+      SeekStream(Archive->Stream,4);
+      GetBlock(Archive->Stream,Block,Size);
+      fwrite(Block,1,Size,NewArc);
+      Free(Block);
+   }
 
    while (! Archive->End) {
 
@@ -219,12 +295,12 @@ static void DeleteArchive(const char *ArchiveName, const char **PatternList) {
       } else {
 
 	 Block = Nalloc(Archive->Header->HeaderSize,"Header");
-	 fread(Block,1,Archive->Header->HeaderSize,Archive->Stream->File);
+	 GetBlock(Archive->Stream,Block,Archive->Header->HeaderSize);
 	 fwrite(Block,1,Archive->Header->HeaderSize,NewArc);
 	 Free(Block);
 
 	 Block = Nalloc(Archive->Header->ArcSize,"File");
-	 fread(Block,1,Archive->Header->ArcSize,Archive->Stream->File);
+	 GetBlock(Archive->Stream,Block,Archive->Header->ArcSize);
 	 fwrite(Block,1,Archive->Header->ArcSize,NewArc);
 	 Free(Block);
       }
@@ -246,7 +322,7 @@ static void ListArchive(const char *ArchiveName, const char **PatternList) {
 
    assert(ArchiveName!=NULL);
 
-   Archive = OpenArchive(ArchiveName);
+   Archive = OpenArchive(StdName(ArchiveName));
    if (Archive == NULL) {
       fprintf(stderr,"missing or corrupt archive \"%s\"",ArchiveName);
       exit(EXIT_FAILURE);
@@ -319,7 +395,7 @@ static void TestArchive(const char *ArchiveName, const char **PatternList) {
 
    assert(ArchiveName!=NULL);
 
-   Archive = OpenArchive(ArchiveName);
+   Archive = OpenArchive(StdName(ArchiveName));
    if (Archive == NULL) {
       fprintf(stderr,"missing or corrupt archive \"%s\"",ArchiveName);
       exit(EXIT_FAILURE);
@@ -343,7 +419,7 @@ static void ExtractArchive(const char *ArchiveName, const char **PatternList) {
 
    assert(ArchiveName!=NULL);
 
-   Archive = OpenArchive(ArchiveName);
+   Archive = OpenArchive(StdName(ArchiveName));
    if (Archive == NULL) {
       fprintf(stderr,"missing or corrupt archive \"%s\"",ArchiveName);
       exit(EXIT_FAILURE);
@@ -360,138 +436,250 @@ static void ExtractArchive(const char *ArchiveName, const char **PatternList) {
    CloseArchive(Archive);
 }
 
+/* MakeDict() */
+
+static void MakeDict(const char *DictName, const char **FileList) {
+
+   int I, FileNb, DictSize;
+   const uchar **Sample;
+   int *SampleSize;
+   uchar *Dict;
+   stream Out[1];
+
+   for (FileNb = 0; FileList[FileNb] != NULL; FileNb++)
+      ;
+
+   Sample     = Nalloc(FileNb*sizeof(uchar *),"Dictionary samples");
+   SampleSize = Nalloc(FileNb*sizeof(int),"Dictionary samples");
+
+   for (I = 0; I < FileNb; I++) {
+      Sample[I] = LoadFile(FileList[I],&SampleSize[I]);
+      if (Sample[I] == NULL) FatalError("Couldn't open file \"%s\"",FileList[I]);
+   }
+
+   Dict     = Nalloc(DICT_SIZE_DEFAULT,"Dictionary");
+   DictSize = TrainDict(Dict,DICT_SIZE_DEFAULT,Sample,SampleSize,FileNb);
+
+   fprintf(Log,"%d bytes from %d file(s)\n",DictSize,FileNb);
+
+   OpenOutStream(Out,StdName(DictName));
+   SendBlock(Out,Dict,DictSize);
+   CloseStream(Out);
+
+   Free(Dict);
+
+   for (I = 0; I < FileNb; I++) Free((void *) Sample[I]);
+
+   Free(SampleSize);
+   Free(Sample);
+}
+
 /* TestFile() */
 
 static void TestFile(archive *Archive) {
 
-   void *Block;
-
    assert(Archive!=NULL);
    assert(!Archive->End);
 
-   Block = Nalloc(Archive->Header->FileSize,Archive->Header->FileName);
-
-   ReadFile(Archive,Block);
+   if (MapFile(Archive) != NULL) return; /* Stored file checked in place */
 
-   Free(Block);
+   WriteFile(Archive,NULL);
 }
 
 /* SaveFile() */
 
 static void SaveFile(archive *Archive) {
 
-   void *Block;
-   FILE *File;
+   const void *Data;
+   stream File[1];
 
    assert(Archive!=NULL);
    assert(!Archive->End);
 
-   Block = Nalloc(Archive->Header->FileSize,Archive->Header->FileName);
+   Data = MapFile(Archive); /* Stored file written straight from the archive */
+
+   OpenOutStream(File,Archive->Header->FileName);
 
-   ReadFile(Archive,Block);
+   if (Data != NULL) {
+      SendBlock(File,Data,Archive->Header->FileSize);
+   } else {
+      WriteFile(Archive,File);
+   }
+
+   CloseStream(File);
+}
+
+/* AddDict() */
+
+static void AddDict(codec *Codec, stream *Arc) {
+
+   header Header[1];
+   stream Member[1];
+   void  *Data;
+   int    MemberSize;
+
+   /* Stored, nameless, before any file */
+
+   Header->HeaderSize = 0;
+   Header->ArcSize = Codec->DictSize;
+   Header->FileNameSize = 0;
+   Header->FileName[0] = '\0';
+   Header->FileSize = Codec->DictSize;
+   Header->Algorithm = ALGO_STORE;
+   Header->Delta = 0;
+   Header->FileCRC = CRC(Codec->Dict,Codec->DictSize);
+   Header->HeaderCRC = 0;
+
+   OpenMemStream(Member,STREAM_WRITE,NULL,Codec->DictSize+STREAM_BUFFER_MIN);
 
-   File = fopen(Archive->Header->FileName,"wb");
-   if (File == NULL) FatalError("Couldn't open file \"%s\" for writing",Archive->Header->FileName);
+   SendHeader(Member,Header);
+   Header->HeaderSize = TellStream(Member);
 
-   fwrite(Block,1,Archive->Header->FileSize,File);
-   fclose(File);
+   if (SeekStream(Member,0) != 0) FatalError("SeekStream()");
+   SendHeader(Member,Header);
+   SendBlock(Member,Codec->Dict,Codec->DictSize);
 
-   Free(Block);
+   Data = MemStreamData(Member,&MemberSize);
+   SendBlock(Arc,Data,MemberSize);
+   if (ferror(Arc->File)) Error("ferror()");
+
+   CloseStream(Member);
 }
 
 /* AddFile() */
 
-static void AddFile(stream *Arc, const char *FileName) {
+static void AddFile(codec *Codec, stream *Arc, const char *FileName) {
 
    header  Header[1];
-   FILE   *File;
-   int     FileNameSize, FileSize;
-   void   *Block;
+   stream  Input[1], Buffer[1], *Member;
+   int     FileNameSize, FileSize, MemberSize, Direct;
+   void   *Block, *Data;
    int     HeaderPos, FilePos, EndPos;
+   long    Size;
 
-   FileNameSize = strlen(FileName);
-
-   File = fopen(FileName,"rb");
-   if (File == NULL) {
-      printf("couldn't open file \"%s\", skipping",FileName);
+   if (! OpenMapStream(Input,StdName(FileName))) {
+      fprintf(Log,"couldn't open file \"%s\", skipping",FileName);
       return;
    }
 
-   if (fseek(File,0,SEEK_END) != 0) {
-      printf("not a plain file \"%s\", skipping",FileName);
+   if (StdName(FileName) == NULL) FileName = InputName; /* Read up to EOF */
+
+   FileNameSize = strlen(FileName);
+   if (FileNameSize == 0 && Codec->Version >= 2) { /* Reserved for the dictionary */
+      fprintf(Log,"empty file name, skipping");
+      CloseStream(Input);
       return;
    }
+   if (FileNameSize > 256) {
+      fprintf(Log,"file name too long \"%s\", skipping",FileName);
+      CloseStream(Input);
+      return;
+   }
+
+   if (Input->Type == STREAM_MEMORY) { /* Mapped or loaded */
 
-   FileSize = ftell(File);
-   rewind(File);
+      Block = MemStreamData(Input,&FileSize);
+
+   } else {
+
+      if (fseek(Input->File,0,SEEK_END) != 0) {
+         fprintf(Log,"not a plain file \"%s\", skipping",FileName);
+         CloseStream(Input);
+         return;
+      }
+
+      Size = ftell(Input->File);
+      if (Size < 0) FatalError("couldn't get the size of \"%s\"",FileName);
+      if (Size > INT_MAX) FatalError("\"%s\" is larger than 2 GB, the largest archive member",FileName);
+
+      FileSize = (int) Size;
+      rewind(Input->File);
+
+      Block = Nalloc(FileSize,FileName);
+      GetBlock(Input,Block,FileSize);
+   }
 
    Header->HeaderSize = 0;
    Header->ArcSize = 0;
    Header->FileNameSize = FileNameSize;
    strcpy(Header->FileName,FileName);
    Header->FileSize = FileSize;
-   Header->Algorithm = Algorithm;
-   Header->Delta = Delta;
+   Header->Algorithm = Codec->Algorithm;
+   Header->Delta = Codec->Delta;
    Header->FileCRC = 0;
    Header->HeaderCRC = 0;
 
-   HeaderPos = ftell(Arc->File);
-   if (HeaderPos == -1) Error("ftell()");
-   if (ferror(Arc->File)) Error("ferror()");
+   /* The member goes straight to the archive, whose header is then written */
+   /* again; it's built in memory first if the archive can't be sought     */
 
-   SendHeader(Arc,Header);
+   Direct = SeekableStream(Arc);
 
-   FilePos = ftell(Arc->File);
-   if (FilePos == -1) Error("ftell()");
-   if (ferror(Arc->File)) Error("ferror()");
+   if (Direct) {
+      Member = Arc;
+   } else {
+      OpenMemStream(Buffer,STREAM_WRITE,NULL,FileSize/2);
+      Member = Buffer;
+   }
 
-   Header->HeaderSize = FilePos - HeaderPos;
+   HeaderPos = TellStream(Member);
 
-   Block = Nalloc(FileSize,FileName);
-   fread(Block,1,FileSize,File);
-   fclose(File);
+   SendHeader(Member,Header);
+
+   FilePos = TellStream(Member);
+
+   Header->HeaderSize = FilePos - HeaderPos;
 
    Header->FileCRC = CRC(Block,FileSize);
 
-   if (Algorithm == ALGO_STORE) {
+   if (Codec->Algorithm == ALGO_STORE) {
 
-      SendBlock(Block,FileSize);
+      SendBlock(Member,Block,FileSize);
 
    } else {
 
       if (Header->Delta != 0) {
-	 Delta = Header->Delta;
-	 CodeDelta(Block,FileSize);
+	 Codec->Delta = Header->Delta;
+	 CodeDelta(Block,FileSize,Codec->Delta);
       }
 
-      OpenBitStream(Arc);
+      OpenBitStream(Member);
 
-      S = Block;
-      N = FileSize; 
-      CrunchBlock();
+      Codec->Out = Member;
+      Codec->S   = Block;
+      Codec->N   = FileSize; 
+      CrunchBlock(Codec);
+      Codec->Out = NULL;
+      Codec->S   = NULL;
 
-      CloseBitStream(Arc);
+      CloseBitStream(Member);
    }
 
-   Free(Block);
+   if (Input->Type != STREAM_MEMORY) Free(Block);
+   CloseStream(Input);
 
-   EndPos = ftell(Arc->File);
-   if (EndPos == -1) Error("ftell()");
-   if (ferror(Arc->File)) Error("ferror()");
+   EndPos = TellStream(Member);
 
    Header->ArcSize = EndPos - FilePos;
 
-   if (fseek(Arc->File,HeaderPos,SEEK_SET) != 0) Error("fseek()");
-   if (ferror(Arc->File)) Error("ferror()");
+   if (SeekStream(Member,HeaderPos) != 0) FatalError("SeekStream()");
+   SendHeader(Member,Header);
+
+   if (Direct) {
+      if (SeekStream(Member,EndPos) != 0) FatalError("SeekStream()");
+   } else {
+      Data = MemStreamData(Buffer,&MemberSize);
+      SendBlock(Arc,Data,MemberSize);
+      CloseStream(Buffer);
+   }
 
-   HeaderPos = ftell(Arc->File);
-   if (HeaderPos == -1) Error("ftell()");
    if (ferror(Arc->File)) Error("ferror()");
+}
 
-   SendHeader(Arc,Header);
+/* StdName() */
 
-   if (fseek(Arc->File,EndPos,SEEK_SET) != 0) Error("fseek()");
-   if (ferror(Arc->File)) Error("ferror()");
+static const char *StdName(const char *Name) {
+
+   return (strcmp(Name,"-") == 0) ? NULL : Name; /* "-" = standard input/output */
 }
 
 /* Match() */
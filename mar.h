@@ -7,7 +7,7 @@
 /* Constant */
 
 #define MAR_NAME    "Melting-Pot Archiver (beta)"
-#define MAR_VERSION 0
+#define MAR_VERSION 4 /* Members use the MCr block framing of the same version, 2 = dictionary member */
 
 #endif /* ! defined MAR_H */
 
@@ -8,6 +8,7 @@
 #include "mcr.h"
 #include "types.h"
 #include "algo.h"
+#include "dict.h"
 
 /* Constants */
 
@@ -28,58 +29,83 @@ static void Usage (void);
 int main(int argc, char *argv[]) {
 
    char *C, *Program;
+   const char *Source, *Destination;
    int Mode;
+   codec Codec[1];
 
    Program     = *argv;
 
    Mode        = MODE_CRUNCH;
-   Algorithm   = ALGO_LZH;
 
    Source      = NULL;
    Destination = NULL;
 
-   Delta       = 0;     /* Delta */
-   Group       = FALSE; /* Huffman tree grouping */
-   Order       = 3;     /* PPM Order */
-   Verbosity   = 0;
+   InitCodec(Codec);
 
    /* Options */
 
    for (argv++; *argv != NULL && (*argv)[0] == '-'; argv++) {
       switch ((*argv)[1]) {
+      case '1' : case '2' : case '3' : case '4' : case '5' :
+      case '6' : case '7' : case '8' : case '9' : /* Level */
+         Codec->Level = (*argv)[1] - '0';
+         break;
       case 'a' : /* Algorithm */
          argv++;
          if (*argv != NULL) {
 	    for (C = *argv; *C != '\0'; C++) *C = toupper(*C);
-	    Algorithm = AlgorithmNo(*argv);
+	    Codec->Algorithm = AlgorithmNo(*argv);
          }
          break;
+      case 'b' : /* Block size */
+         argv++;
+         if (*argv == NULL || atoi(*argv) < BLOCK_MIN || atoi(*argv) > BLOCK_MAX) Usage();
+         Codec->Block = atoi(*argv) * 1024;
+         break;
       case 'd' : /* Decrunch */
          Mode = MODE_DECRUNCH;
          break;
+      case 'D' : /* Dictionary */
+         argv++;
+         if (*argv == NULL) Usage();
+         LoadDict(Codec,*argv);
+         break;
       case 'g' : /* Group */
-         Group = TRUE;
+         Codec->Group = TRUE;
+         break;
+      case 'j' : /* Threads */
+         argv++;
+         if (*argv == NULL || atoi(*argv) < 1 || atoi(*argv) > THREAD_MAX) Usage();
+         Codec->Threads = atoi(*argv);
+         break;
+      case 'l' : /* Long matches */
+         Codec->Long = TRUE;
          break;
       case 'o' : /* Order */
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Order = atoi(*argv);
+            Codec->Order = atoi(*argv);
          }
          break;
       case 't' : /* Delta */
-	 Delta = -1;
+	 Codec->Delta = -1;
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Delta = atoi(*argv);
+            Codec->Delta = atoi(*argv);
          }
          break;
       case 'v' : /* Verbosity */
-         Verbosity = 1;
+         Codec->Verbosity = 1;
          if (argv[1] != NULL && isdigit(argv[1][0])) {
             argv++;
-            Verbosity = atoi(*argv);
+            Codec->Verbosity = atoi(*argv);
          }
          break;
+      case 'w' : /* Window */
+         argv++;
+         if (*argv == NULL || atoi(*argv) < WINDOW_MIN || atoi(*argv) > WINDOW_MAX) Usage();
+         Codec->Window = atoi(*argv);
+         break;
       }
    }
 
@@ -103,7 +129,7 @@ int main(int argc, char *argv[]) {
 
    /* Let's go ! */
 
-   if (Verbosity >= 1) {
+   if (Codec->Verbosity >= 1) {
 
       fprintf(stderr,MCR_NAME "\n");
 
@@ -129,7 +155,7 @@ int main(int argc, char *argv[]) {
       }
 
       if (Mode == MODE_CRUNCH) {
-	 fprintf(stderr," using %s algorithm",AlgorithmName(Algorithm));
+	 fprintf(stderr," using %s algorithm",AlgorithmName(Codec->Algorithm));
       }
 
       fprintf(stderr,"\n");
@@ -137,13 +163,15 @@ int main(int argc, char *argv[]) {
 
    switch (Mode) {
    case MODE_CRUNCH :
-      CrunchFile();
+      CrunchFile(Codec,Source,Destination);
       break;
    case MODE_DECRUNCH :
-      DecrunchFile();
+      DecrunchFile(Codec,Source,Destination);
       break;
    }
 
+   FreeDict(Codec);
+
    return EXIT_SUCCESS;
 }
 
@@ -152,7 +180,7 @@ int main(int argc, char *argv[]) {
 static void Usage(void) {
  
    fprintf(stderr,"Usage: %s [<options>] [<source> [<destination>]]\n",Program);
-   fprintf(stderr,"       <option> = -a <algo> | -d | -g | -o <order> | -t [<delta>] | -v [<level>]\n");
+   fprintf(stderr,"       <option> = -1..-9 | -a <algo> | -b <block KB> | -d | -D <dict> | -g | -j <threads> | -l | -o <order> | -t [<delta>] | -v [<level>] | -w <window>\n");
 
    exit(EXIT_FAILURE);
 }
@@ -7,10 +7,6 @@
 #include "types.h"
 #include "debug.h"
 
-/* Variables */
-
-static uchar M2F[256];
-
 /* Functions */
 
 /* CodeMTF() */
@@ -18,6 +14,7 @@ static uchar M2F[256];
 void CodeMTF(void *Block, int Size) {
 
    int I, J, C;
+   uchar M2F[256];
    uchar *Buffer;
 
    Buffer = Block;
@@ -39,6 +36,7 @@ void CodeMTF(void *Block, int Size) {
 void DecodeMTF(void *Block, int Size) {
 
    int I, J, C;
+   uchar M2F[256];
    uchar *Buffer;
 
    Buffer = Block;
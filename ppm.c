@@ -29,41 +29,43 @@ struct node {
    node  *Brother;
 };
 
-/* Variables */
-
-static node *Root;
-static int   Memory;
-
 /* Prototypes */
 
-static node *AddString  (node *Node, const uchar String[], int Size);
+static node *AddString  (node *Node, const uchar String[], int Size, long *Memory);
 static node *StringNode (node *Node, const uchar String[], int Size);
 static node *CharNode   (node *Node, int Char);
 
-static node *NewNode    (void);
+static node *NewNode    (long *Memory);
 
 /* Functions */
 
 /* CodePPM() */
 
-void CodePPM(void) {
+void CodePPM(codec *Codec) {
 
-   int I, C, O, SymLow, SymHigh, SymTot, SymEsc;
+   int I, C, O, N, Order, SymLow, SymHigh, SymTot, SymEsc;
+   long Memory;
    int Excluded[256];
-   node *Node, *Context[ORDER_MAX+1], *Char, **Pred;
+   const uchar *S;
+   node *Root, *Node, *Context[ORDER_MAX+1], *Char, **Pred;
+   aricoder Coder[1];
 
-   if (Order < 0) {
-      Order = 0;
-   } else if (Order > ORDER_MAX) {
-      Order = ORDER_MAX;
+   S = Codec->S;
+   N = Codec->N;
+
+   if (Codec->Order < 0) {
+      Codec->Order = 0;
+   } else if (Codec->Order > ORDER_MAX) {
+      Codec->Order = ORDER_MAX;
    }
-   SendBits(ORDER_BIT,Order);
+   Order = Codec->Order;
+   SendBits(Codec->Out,ORDER_BIT,Order);
 
    Memory = 0;
 
-   SendStart();
+   SendStart(Coder,Codec->Out);
 
-   Root = NewNode();
+   Root = NewNode(&Memory);
 
    Context[0] = Root;
    for (O = 1; O <= Order; O++) Context[O] = NULL;
@@ -98,10 +100,10 @@ void CodePPM(void) {
                }
 
                if (SymHigh != 0) {
-                  SendAriRange(SymLow,SymHigh,SymTot+SymEsc);
+                  SendAriRange(Coder,SymLow,SymHigh,SymTot+SymEsc);
                   break;
                } else {
-                  SendAriRange(SymTot,SymTot+SymEsc,SymTot+SymEsc);
+                  SendAriRange(Coder,SymTot,SymTot+SymEsc,SymTot+SymEsc);
                }
             }
          }
@@ -123,7 +125,7 @@ void CodePPM(void) {
             }
          }
 
-         SendAriRange(SymLow,SymHigh,SymTot);
+         SendAriRange(Coder,SymLow,SymHigh,SymTot);
       }
 
       for (O = Order; O >= 0; O--) {
@@ -143,7 +145,7 @@ void CodePPM(void) {
 
             if (Char == NULL) {
 
-               Char            = NewNode();
+               Char            = NewNode(&Memory);
                Char->Char      = C;
                Char->Brother   = Context[O]->Son;
                Context[O]->Son = Char;
@@ -183,26 +185,32 @@ void CodePPM(void) {
       }
    }
 
-   SendEnd();
+   SendEnd(Coder);
 
-   if (Verbosity >= 2) fprintf(stderr,"%d bytes allocated\n",Memory);
+   if (Codec->Verbosity >= 2) fprintf(stderr,"%ld bytes allocated\n",Memory);
 }
 
 /* DecodePPM() */
 
-void DecodePPM(void) {
+void DecodePPM(codec *Codec) {
 
-   int I, C, O, SymLow, SymHigh, SymTot, SymEsc, SymCode;
+   int I, C, O, N, Order, SymLow, SymHigh, SymTot, SymEsc, SymCode;
+   long Memory;
    int Excluded[256];
-   node *Node, *Context[ORDER_MAX+1], *Char, **Pred;
+   uchar *S;
+   node *Root, *Node, *Context[ORDER_MAX+1], *Char, **Pred;
+   aricoder Coder[1];
+
+   S = Codec->S;
+   N = Codec->N;
 
-   Order = GetBits(ORDER_BIT);
+   Order = GetBits(Codec->In,ORDER_BIT);
 
    Memory = 0;
 
-   GetStart();
+   GetStart(Coder,Codec->In);
 
-   Root = NewNode();
+   Root = NewNode(&Memory);
 
    Context[0] = Root;
    for (O = 1; O <= Order; O++) Context[O] = NULL;
@@ -227,14 +235,14 @@ void DecodePPM(void) {
                   }
                }
 
-               SymCode = GetAriRange(SymTot+SymEsc);
+               SymCode = GetAriRange(Coder,SymTot+SymEsc);
 
                if (SymCode >= SymTot) {
 
                   for (Node = Context[O]->Son; Node != NULL; Node = Node->Brother) {
                      if (Node->Freq != 0) Excluded[Node->Char] = TRUE;
                   }
-                  SkipAriRange(SymTot,SymTot+SymEsc,SymTot+SymEsc);
+                  SkipAriRange(Coder,SymTot,SymTot+SymEsc,SymTot+SymEsc);
 
                } else {
 
@@ -249,7 +257,7 @@ void DecodePPM(void) {
                         }
                      }
                   }
-                  SkipAriRange(SymLow,SymHigh,SymTot+SymEsc);
+                  SkipAriRange(Coder,SymLow,SymHigh,SymTot+SymEsc);
 
                   S[I] = Node->Char;
                   break;
@@ -265,7 +273,7 @@ void DecodePPM(void) {
             if (! Excluded[C]) SymTot++;
          }
 
-         SymCode = GetAriRange(SymTot);
+         SymCode = GetAriRange(Coder,SymTot);
 
          SymLow  = 0;
          SymHigh = 0;
@@ -278,7 +286,7 @@ void DecodePPM(void) {
                }
             }
          }
-         SkipAriRange(SymLow,SymHigh,SymTot);
+         SkipAriRange(Coder,SymLow,SymHigh,SymTot);
 
          S[I] = C;
       }
@@ -300,7 +308,7 @@ void DecodePPM(void) {
 
             if (Char == NULL) {
 
-               Char            = NewNode();
+               Char            = NewNode(&Memory);
                Char->Char      = C;
                Char->Brother   = Context[O]->Son;
                Context[O]->Son = Char;
@@ -340,14 +348,14 @@ void DecodePPM(void) {
       }
    }
 
-   GetEnd();
+   GetEnd(Coder);
 
-   if (Verbosity >= 2) fprintf(stderr,"%d bytes allocated\n",Memory);
+   if (Codec->Verbosity >= 2) fprintf(stderr,"%ld bytes allocated\n",Memory);
 }
 
 /* AddString() */
 
-static node *AddString(node *Node, const uchar String[], int Size) {
+static node *AddString(node *Node, const uchar String[], int Size, long *Memory) {
 
    int I, C;
    node *Father, *Older;
@@ -360,7 +368,7 @@ static node *AddString(node *Node, const uchar String[], int Size) {
       Node   = Node->Son;
 
       if (Node == NULL) {
-         Node = NewNode();
+         Node = NewNode(Memory);
          Node->Char  = C;
          Father->Son = Node;
       }
@@ -371,7 +379,7 @@ static node *AddString(node *Node, const uchar String[], int Size) {
          Node  = Node->Brother;
 
          if (Node == NULL) {
-            Node = NewNode();
+            Node = NewNode(Memory);
             Node->Char     = C;
             Older->Brother = Node;
          }
@@ -407,14 +415,14 @@ static node *CharNode(node *Node, int Char) {
 
 /* NewNode() */
 
-static node *NewNode(void) {
+static node *NewNode(long *Memory) {
 
    node *Node;
 
    Node = malloc(sizeof(node));
    if (Node == NULL) FatalError("NewNode(): Not enough memory");
 
-   Memory += sizeof(node);
+   *Memory += (long) sizeof(node);
 
    Node->Char    = '\0';
    Node->Freq    = 0;
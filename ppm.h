@@ -4,10 +4,12 @@
 #ifndef PPM_H
 #define PPM_H
 
+#include "algo.h"
+
 /* Prototypes */
 
-extern void CodePPM   (void);
-extern void DecodePPM (void);
+extern void CodePPM   (codec *Codec);
+extern void DecodePPM (codec *Codec);
 
 #endif /* ! defined PPM_H */
 
@@ -4,7 +4,6 @@
 #include "rle.h"
 #include "types.h"
 #include "algo.h"
-#include "bwt.h"
 #include "hufblock.h"
 #include "debug.h"
 
@@ -12,32 +11,36 @@
 
 /* CodeRLE() */
 
-void CodeRLE(void) {
+void CodeRLE(hufblock *HufBlock, const uchar *L, int N) {
 
-   int BlockPos, Len;
+   int BlockPos, Len, Size;
+   ushort *Sym;
 
-   HufBlockSize = 0;
+   Sym  = HufBlock->Sym;
+   Size = 0;
 
    for (BlockPos = 0; BlockPos < N;) {
       if (L[BlockPos] == 0) {
          for (Len = -1; BlockPos < N && L[BlockPos] == 0; Len++) BlockPos++;
 	 while (TRUE) {
-	    HufBlock[HufBlockSize++] = Len & 1;
+	    Sym[Size++] = Len & 1;
 	    Len -= 2;
 	    if (Len < 0) break;
 	    Len >>= 1;
 	 }
       } else {
-         HufBlock[HufBlockSize++] = L[BlockPos++] + 1;
+         Sym[Size++] = L[BlockPos++] + 1;
       }
    }
 
-   if (HufBlockSize > N) FatalError("HufBlockSize (%d) > N (%d) in CodeRLE()",HufBlockSize,N);
+   if (Size > N) FatalError("HufBlockSize (%d) > N (%d) in CodeRLE()",Size,N);
+
+   HufBlock->Size = Size;
 }
 
 /* DecodeRLE() */
 
-void DecodeRLE(void) {
+void DecodeRLE(uchar *L, int N, const hufblock *HufBlock) {
 
    int I, BlockPos, Len, Inc, Code;
 
@@ -45,8 +48,8 @@ void DecodeRLE(void) {
    Len      = 0;
    Inc      = 1;
 
-   for (I = 0; I < HufBlockSize; I++) {
-      Code = HufBlock[I];
+   for (I = 0; I < HufBlock->Size; I++) {
+      Code = HufBlock->Sym[I];
       if (Code == 0) {
          Len += Inc;
          Inc <<= 1;
@@ -4,10 +4,13 @@
 #ifndef RLE_H
 #define RLE_H
 
+#include "types.h"
+#include "hufblock.h"
+
 /* Prototypes */
 
-extern void CodeRLE   (void);
-extern void DecodeRLE (void);
+extern void CodeRLE   (hufblock *HufBlock, const uchar *L, int N);
+extern void DecodeRLE (uchar *L, int N, const hufblock *HufBlock);
 
 #endif /* ! defined RLE_H */
 
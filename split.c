@@ -0,0 +1,247 @@
+
+/* Split.C */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "split.h"
+#include "types.h"
+#include "debug.h"
+#include "huffman.h"
+
+/* Constants */
+
+#define ROOT 1
+
+/* Prototypes */
+
+static void MergeCost (split *Split, huftable *HufTable, int B);
+
+static void PushGain  (split *Split, int Gain, int B);
+static void PopGain   (split *Split);
+static int  Better    (const split_gain *G1, const split_gain *G2);
+
+/* Functions */
+
+/* SplitBlocks() */
+
+void SplitBlocks(split *Split, huftable *HufTable, const ushort Sym[], int N, int SizeMin, int Group, int Verbosity) {
+
+   int I, B, BlockNb, SymbolNb, *Freq;
+   split_block *Block, *Succ;
+   split_gain Top;
+
+   SymbolNb = HufTable->N;
+   BlockNb  = (N + SizeMin - 1) / SizeMin;
+
+   Split->SymbolNb = SymbolNb;
+   Split->BlockNb  = BlockNb;
+   Split->Len      = 0;
+   Split->Head     = (BlockNb > 0) ? 0 : SPLIT_NONE;
+   Split->HeapSize = 0;
+
+   Split->Block    = Nalloc((BlockNb+1)*sizeof(split_block),"Split blocks");
+   Split->FreqPool = NULL;
+   Split->Freq     = Nalloc(SymbolNb*sizeof(int),"Split frequencies");
+   Split->Heap     = (Group) ? Nalloc((3*BlockNb+1)*sizeof(split_gain),"Split heap") : NULL;
+
+   /* Merging needs the counts of every block, about 4 bytes per symbol; */
+   /* otherwise BlockFreq() counts each block again when it's sent       */
+
+   if (Group) {
+      if ((size_t) BlockNb + 1 > ((size_t) -1) / sizeof(int) / (size_t) SymbolNb) FatalError("SplitBlocks(): Too many symbols (%d)",N);
+      Split->FreqPool = malloc(((size_t)BlockNb+1)*(size_t)SymbolNb*sizeof(int));
+      if (Split->FreqPool == NULL) FatalError("SplitBlocks(): Not enough memory");
+   }
+
+   for (B = 0; B < BlockNb; B++) {
+
+      Block = &Split->Block[B];
+
+      Block->Start = B * SizeMin;
+      Block->End   = Block->Start + SizeMin;
+      if (Block->End > N) Block->End = N;
+      Block->Size  = Block->End - Block->Start;
+
+      Block->Pred  = (B > 0) ? B - 1 : SPLIT_NONE;
+      Block->Succ  = (B < BlockNb-1) ? B + 1 : SPLIT_NONE;
+      Block->Stamp = 0;
+
+      Block->Freq  = (Group) ? &Split->FreqPool[(size_t)B*(size_t)SymbolNb] : NULL;
+
+      Block->Len      = 0;
+      Block->MergeLen = 0;
+
+      if (Group || Verbosity >= 2) {
+         Freq = (Group) ? Block->Freq : Split->Freq;
+         for (I = 0; I < SymbolNb; I++)              Freq[I] = 0;
+         for (I = Block->Start; I < Block->End; I++) Freq[Sym[I]]++;
+         CompLens(HufTable,Freq);
+         Block->Len = PredictLen(HufTable);
+      }
+
+      Split->Len += Block->Len;
+   }
+
+   if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",BlockNb,(double)N/(double)BlockNb,(double)Split->Len/8.0);
+
+   if (! Group) return;
+
+   /* Greedy merging, best gain first (leftmost on ties). Each merge only */
+   /* changes the gains of the merged block and its predecessor, whose    */
+   /* older heap entries are recognised as stale by their stamp           */
+
+   for (B = 0; B < BlockNb; B++) MergeCost(Split,HufTable,B);
+
+   while (Split->HeapSize > 0) {
+
+      Top = Split->Heap[ROOT];
+      PopGain(Split);
+
+      Block = &Split->Block[Top.Block];
+      if (Top.Stamp != Block->Stamp) continue;
+
+      Succ = &Split->Block[Block->Succ];
+
+      Split->BlockNb--;
+      Split->Len -= Top.Gain;
+
+      if (Verbosity >= 3) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f, Gain = %7.2f\n",Split->BlockNb,(double)N/(double)Split->BlockNb,(double)Split->Len/8.0,(double)Top.Gain/8.0);
+
+      Block->End   = Succ->End;
+      Block->Size += Succ->Size;
+      Block->Len   = Block->MergeLen;
+
+      for (I = 0; I < SymbolNb; I++) Block->Freq[I] += Succ->Freq[I];
+
+      Succ->Stamp++; /* Gone */
+
+      Block->Succ = Succ->Succ;
+      if (Block->Succ != SPLIT_NONE) Split->Block[Block->Succ].Pred = Top.Block;
+
+      MergeCost(Split,HufTable,Top.Block);
+      if (Block->Pred != SPLIT_NONE) MergeCost(Split,HufTable,Block->Pred);
+   }
+
+   if (Verbosity >= 2) fprintf(stderr,"BlockNb = %4d, BlockSize = %9.2f, TotalLen = %10.2f\n",Split->BlockNb,(double)N/(double)Split->BlockNb,(double)Split->Len/8.0);
+}
+
+/* FreeSplit() */
+
+void FreeSplit(split *Split) {
+
+   if (Split->Block != NULL) {
+      Free(Split->Block);
+      Split->Block = NULL;
+   }
+
+   if (Split->FreqPool != NULL) {
+      free(Split->FreqPool);
+      Split->FreqPool = NULL;
+   }
+
+   if (Split->Freq != NULL) {
+      Free(Split->Freq);
+      Split->Freq = NULL;
+   }
+
+   if (Split->Heap != NULL) {
+      Free(Split->Heap);
+      Split->Heap = NULL;
+   }
+}
+
+/* BlockFreq() */
+
+const int *BlockFreq(split *Split, const ushort Sym[], int B) {
+
+   int I;
+   const split_block *Block;
+
+   Block = &Split->Block[B];
+
+   if (Block->Freq != NULL) return Block->Freq;
+
+   for (I = 0; I < Split->SymbolNb; I++)        Split->Freq[I] = 0;
+   for (I = Block->Start; I < Block->End; I++) Split->Freq[Sym[I]]++;
+
+   return Split->Freq;
+}
+
+/* MergeCost() */
+
+static void MergeCost(split *Split, huftable *HufTable, int B) {
+
+   int I, Gain;
+   split_block *Block, *Succ;
+
+   Block = &Split->Block[B];
+
+   Block->Stamp++;
+
+   if (Block->Succ == SPLIT_NONE) return;
+
+   Succ = &Split->Block[Block->Succ];
+   if (Block->Size + Succ->Size > SPLIT_SIZE_MAX) return; /* Sizes only grow */
+
+   for (I = 0; I < Split->SymbolNb; I++) Split->Freq[I] = Block->Freq[I] + Succ->Freq[I];
+   CompLens(HufTable,Split->Freq);
+   Block->MergeLen = PredictLen(HufTable);
+
+   Gain = Block->Len + Succ->Len - Block->MergeLen + SPLIT_SIZE_BIT + 1;
+   if (Gain >= 0) PushGain(Split,Gain,B);
+}
+
+/* PushGain() */
+
+static void PushGain(split *Split, int Gain, int B) {
+
+   int Node, Father;
+   split_gain *Heap, New;
+
+   Heap = Split->Heap;
+
+   New.Gain  = Gain;
+   New.Block = B;
+   New.Stamp = Split->Block[B].Stamp;
+
+   for (Node = ++Split->HeapSize; Node > ROOT; Node = Father) {
+      Father = Node >> 1;
+      if (! Better(&New,&Heap[Father])) break;
+      Heap[Node] = Heap[Father];
+   }
+
+   Heap[Node] = New;
+}
+
+/* PopGain() */
+
+static void PopGain(split *Split) {
+
+   int Node, Son, HeapSize;
+   split_gain *Heap, Last;
+
+   Heap     = Split->Heap;
+   HeapSize = --Split->HeapSize;
+   Last     = Heap[HeapSize+1];
+
+   for (Node = ROOT; (Son = Node << 1) <= HeapSize; Node = Son) {
+      if (Son < HeapSize && Better(&Heap[Son+1],&Heap[Son])) Son++;
+      if (! Better(&Heap[Son],&Last)) break;
+      Heap[Node] = Heap[Son];
+   }
+
+   Heap[Node] = Last;
+}
+
+/* Better() */
+
+static int Better(const split_gain *G1, const split_gain *G2) {
+
+   if (G1->Gain != G2->Gain) return G1->Gain > G2->Gain;
+
+   return G1->Block < G2->Block;
+}
+
+/* End of Split.C */
+
@@ -0,0 +1,58 @@
+
+/* Split.H */
+
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include "types.h"
+#include "huffman.h"
+
+/* Constants */
+
+#define SPLIT_SIZE_MAX 65536 /* Symbols per huffman block */
+#define SPLIT_SIZE_BIT 16
+#define SPLIT_NONE     (-1)
+
+/* Types */
+
+typedef struct {
+   int  Start;
+   int  End;
+   int  Size;
+   int  Len;      /* Predicted bits, code lengths included */
+   int  MergeLen; /* Same, merged with the next block */
+   int  Pred;
+   int  Succ;
+   int  Stamp;    /* Bumped whenever the merge gain changes */
+   int *Freq;     /* Counts, NULL without grouping (see BlockFreq()) */
+} split_block;
+
+typedef struct {
+   int          Gain;
+   int          Block;
+   int          Stamp;
+} split_gain;
+
+typedef struct {
+   int          SymbolNb; /* Alphabet size */
+   int          BlockNb;  /* Blocks left after merging */
+   int          Len;      /* Predicted bits, all blocks */
+   int          Head;     /* First block, then follow Succ up to SPLIT_NONE */
+   split_block *Block;
+   int         *FreqPool; /* SymbolNb counts per initial block, grouping only */
+   int         *Freq;     /* Scratch counts */
+   split_gain  *Heap;     /* Max-heap of merge gains, stale entries included */
+   int          HeapSize;
+} split;
+
+/* Prototypes */
+
+extern void SplitBlocks (split *Split, huftable *HufTable, const ushort Sym[], int N, int SizeMin, int Group, int Verbosity);
+extern void FreeSplit   (split *Split);
+
+extern const int *BlockFreq (split *Split, const ushort Sym[], int B);
+
+#endif /* ! defined SPLIT_H */
+
+/* End of Split.H */
+
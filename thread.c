@@ -0,0 +1,133 @@
+
+/* Thread.C */
+
+#include <stdio.h>
+
+#include "thread.h"
+#include "types.h"
+#include "debug.h"
+
+/* Prototypes */
+
+#ifdef THREADS
+static void *RunThread (void *Data);
+#endif
+
+/* Functions */
+
+/* ThreadSupport() */
+
+int ThreadSupport(void) {
+
+#ifdef THREADS
+   return TRUE;
+#else
+   return FALSE;
+#endif
+}
+
+/* StartThread() */
+
+void StartThread(thread *Thread, void (*Function) (void *Data), void *Data) {
+
+   assert(Thread!=NULL);
+   assert(Function!=NULL);
+
+   Thread->Function = Function;
+   Thread->Data     = Data;
+
+#ifdef THREADS
+   if (pthread_create(&Thread->Id,NULL,&RunThread,Thread) != 0) FatalError("StartThread(): pthread_create()");
+#endif
+}
+
+/* JoinThread() */
+
+void JoinThread(thread *Thread) {
+
+   assert(Thread!=NULL);
+
+#ifdef THREADS
+   if (pthread_join(Thread->Id,NULL) != 0) FatalError("JoinThread(): pthread_join()");
+#else
+   Thread->Function(Thread->Data); /* No threads => run it now */
+#endif
+}
+
+/* RunThread() */
+
+#ifdef THREADS
+
+static void *RunThread(void *Data) {
+
+   thread *Thread;
+
+   Thread = Data;
+   Thread->Function(Thread->Data);
+
+   return NULL;
+}
+
+#endif
+
+/* InitSemaphore() */
+
+void InitSemaphore(semaphore *Semaphore, int Count) {
+
+   assert(Semaphore!=NULL);
+   assert(Count>=0);
+
+   Semaphore->Count = Count;
+
+#ifdef THREADS
+   if (pthread_mutex_init(&Semaphore->Mutex,NULL) != 0) FatalError("InitSemaphore(): pthread_mutex_init()");
+   if (pthread_cond_init(&Semaphore->Cond,NULL) != 0) FatalError("InitSemaphore(): pthread_cond_init()");
+#endif
+}
+
+/* FreeSemaphore() */
+
+void FreeSemaphore(semaphore *Semaphore) {
+
+   assert(Semaphore!=NULL);
+
+#ifdef THREADS
+   pthread_cond_destroy(&Semaphore->Cond);
+   pthread_mutex_destroy(&Semaphore->Mutex);
+#endif
+}
+
+/* WaitSemaphore() */
+
+void WaitSemaphore(semaphore *Semaphore) {
+
+   assert(Semaphore!=NULL);
+
+#ifdef THREADS
+   pthread_mutex_lock(&Semaphore->Mutex);
+   while (Semaphore->Count == 0) pthread_cond_wait(&Semaphore->Cond,&Semaphore->Mutex);
+   Semaphore->Count--;
+   pthread_mutex_unlock(&Semaphore->Mutex);
+#else
+   if (Semaphore->Count == 0) FatalError("WaitSemaphore(): deadlock");
+   Semaphore->Count--;
+#endif
+}
+
+/* PostSemaphore() */
+
+void PostSemaphore(semaphore *Semaphore) {
+
+   assert(Semaphore!=NULL);
+
+#ifdef THREADS
+   pthread_mutex_lock(&Semaphore->Mutex);
+   Semaphore->Count++;
+   pthread_cond_signal(&Semaphore->Cond);
+   pthread_mutex_unlock(&Semaphore->Mutex);
+#else
+   Semaphore->Count++;
+#endif
+}
+
+/* End of Thread.C */
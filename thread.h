@@ -0,0 +1,46 @@
+
+/* Thread.H */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
+#include "types.h"
+
+/* Types */
+
+typedef struct {
+#ifdef THREADS
+   pthread_t       Id;
+#endif
+   void          (*Function) (void *Data);
+   void           *Data;
+} thread;
+
+typedef struct {
+   int             Count;
+#ifdef THREADS
+   pthread_mutex_t Mutex;
+   pthread_cond_t  Cond;
+#endif
+} semaphore;
+
+/* Prototypes */
+
+extern int  ThreadSupport (void);
+
+extern void StartThread   (thread *Thread, void (*Function) (void *Data), void *Data);
+extern void JoinThread    (thread *Thread);
+
+extern void InitSemaphore (semaphore *Semaphore, int Count);
+extern void FreeSemaphore (semaphore *Semaphore);
+
+extern void WaitSemaphore (semaphore *Semaphore);
+extern void PostSemaphore (semaphore *Semaphore);
+
+#endif /* ! defined THREAD_H */
+
+/* End of Thread.H */
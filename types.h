@@ -19,6 +19,12 @@ typedef unsigned char  uchar;
 typedef unsigned short ushort;
 typedef unsigned int   uint;
 
+#ifdef __GNUC__
+__extension__ typedef unsigned long long uint64;
+#else
+typedef unsigned long  uint64;
+#endif
+
 #endif /* ! defined TYPES_H */
 
 #endif /* ! defined MAIN_H */